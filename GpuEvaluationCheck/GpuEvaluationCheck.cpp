@@ -0,0 +1,364 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <iomanip>
+#include <algorithm>
+
+#include "glad/glad.h"
+#ifdef _WIN32
+#include "GLFW/glfw3.h"
+#else
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include "InputHandler.h"
+#include "ExpressionProgram.h"
+#include "ExpressionJit.h"
+#include "ExpressionOptimiser.h"
+#include "GraphLogic.h"
+#include "ShaderProgram.h"
+#include "SurfaceShader.h"
+
+// Checks that graphs evaluated on the GPU by SurfaceShader match the CPU samples the rest of the visualiser uses. Every vertex the
+// generated shader produces is captured with transform feedback, without drawing anything, and compared with GraphLogic::sample_points.
+// A fixed corpus is checked at several resolutions and domains, and the largest height and normal differences are printed for each expression.
+// Exits with 1 if any expression is further out than the tolerances below, or if its heights differ in being finite when they should not.
+// Needs no window: a hidden GLFW window on Windows, an EGL surfaceless context elsewhere, such as Mesa llvmpipe.
+// Usage: GpuEvaluationCheck [path to surface_vertex_shader.txt]
+
+// An expression of the corpus, and whether the GPU may find a height where the CPU does not, or the other way round. GLSL leaves pow
+// undefined for a negative base and does not promise how division by zero rounds, so only poles and powers that can be undefined are allowed to differ
+struct CorpusEntry
+{
+	const char* expression;
+	bool mayDifferInFiniteness;
+};
+
+static const CorpusEntry corpus[] = {
+	{ "x^2+y^2", false },
+	{ "x*y", false },
+	{ "x^2-y^2", false },
+	{ "x/y", true },
+	{ "(x+y)^3", false },
+	{ "x^3-3*x*y^2", false },
+	{ "2xy - y^3", false },
+	{ "(x^2+y^2)^(1/2)", false },
+	{ "1/(x^2+y^2+1)", false },
+	{ "x^4+y^4-2*x^2*y^2+x*y", false },
+	{ "x^y", true },
+	{ "y^(x+3)", true },
+	{ "2^x", false },
+	{ "x^20", false },
+	{ "x^(0-3)", true },
+	{ "1/0*x", true },
+	{ "(x-y)^(1/3)", true },
+	{ "x^17y", false },
+	{ "5", false },
+};
+
+static const int sampleSizes[] = { 20, 81, 256 };
+static const GraphDomain domains[] = { { 0.f, 0.f, 0 }, { 3.3f, -1.7f, 2 }, { -0.2f, 0.9f, -3 } };
+
+static const int floatsPerVertex = 7; // gl_Position then worldNormal, as captured
+
+// GLSL only bounds pow, exp2 and log2 to a few ulp, so the GPU's heights and normals are allowed to be a little further out than float rounding alone
+static const double heightTolerance = 1e-4; // compared with Differences::relativeHeight
+static const double normalTolerance = 1e-3; // compared with Differences::normal
+
+// The largest differences found so far between the two evaluations
+struct Differences
+{
+	double relativeHeight = 0.0; // |gpu - cpu| / max(1, |cpu|), so small heights are compared absolutely
+	double normal = 0.0; // the largest difference in any component of the unit normal
+	long long positionMismatches = 0; // x and y are found the same way on both sides, so any difference is a bug
+	long long finiteMismatches = 0; // one side has a height and the other does not, a pole or an undefined power handled differently
+	long long points = 0;
+
+	void add(const Differences& other)
+	{
+		relativeHeight = std::max(relativeHeight, other.relativeHeight);
+		normal = std::max(normal, other.normal);
+		positionMismatches += other.positionMismatches;
+		finiteMismatches += other.finiteMismatches;
+		points += other.points;
+	}
+};
+
+#ifdef _WIN32
+static bool create_headless_context()
+{
+	if (!glfwInit()) return false;
+
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+	GLFWwindow* window = glfwCreateWindow(1, 1, "GpuEvaluationCheck", nullptr, nullptr);
+	if (window == nullptr) return false;
+
+	glfwMakeContextCurrent(window);
+	return gladLoadGLLoader((GLADloadproc)glfwGetProcAddress) != 0;
+}
+#else
+static bool create_headless_context()
+{
+	EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	EGLint major;
+	EGLint minor;
+	if (!eglInitialize(display, &major, &minor) || !eglBindAPI(EGL_OPENGL_API)) return false;
+
+	const EGLint configAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config;
+	EGLint configCount = 0;
+	eglChooseConfig(display, configAttributes, &config, 1, &configCount);
+
+	// 4.6 is asked for first, software renderers such as llvmpipe may only offer 4.5, see make_compatible
+	EGLint contextAttributes[] = { EGL_CONTEXT_MAJOR_VERSION, 4, EGL_CONTEXT_MINOR_VERSION, 6, EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE };
+	EGLContext context = EGL_NO_CONTEXT;
+
+	for (int minorVersion = 6; minorVersion >= 5 && context == EGL_NO_CONTEXT; minorVersion--)
+	{
+		contextAttributes[3] = minorVersion;
+		context = eglCreateContext(display, configCount > 0 ? config : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttributes);
+	}
+	if (context == EGL_NO_CONTEXT) return false;
+
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context); // surfaceless, nothing is ever drawn
+	if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) return false;
+
+	// without a surface there is no default framebuffer, and draws fail even with rasterisation discarded, so a 1x1 one stands in for it
+	unsigned int colour;
+	glCreateRenderbuffers(1, &colour);
+	glNamedRenderbufferStorage(colour, GL_RGBA8, 1, 1);
+
+	unsigned int framebuffer;
+	glCreateFramebuffers(1, &framebuffer);
+	glNamedFramebufferRenderbuffer(framebuffer, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colour);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+	return true;
+}
+#endif
+
+// The shaders are written for 4.6, where gl_BaseInstance is core. 4.5 has it through ARB_shader_draw_parameters under another name
+static std::string make_compatible(std::string source)
+{
+	if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 6)) return source;
+
+	const std::string version = "#version 460 core";
+	const size_t versionPosition = source.find(version);
+	if (versionPosition != std::string::npos)
+	{
+		source.replace(versionPosition, version.size(), "#version 450 core\n#extension GL_ARB_shader_draw_parameters : require");
+	}
+
+	const std::string baseInstance = "gl_BaseInstance";
+	for (size_t position = source.find(baseInstance); position != std::string::npos; position = source.find(baseInstance, position))
+	{
+		source.replace(position, baseInstance.size(), "gl_BaseInstanceARB");
+		position += baseInstance.size() + 3;
+	}
+
+	return source;
+}
+
+// Links the generated vertex shader on its own, with its outputs captured, which ShaderProgram::link has no need to support
+static unsigned int link_capturing_program(const std::string& source)
+{
+	const unsigned int vertexShader = ShaderProgram::compile_shader(GL_VERTEX_SHADER, source);
+	if (vertexShader == 0) return 0;
+
+	const unsigned int program = glCreateProgram();
+	glAttachShader(program, vertexShader);
+
+	const char* const capturedOutputs[] = { "gl_Position", "worldNormal" };
+	glTransformFeedbackVaryings(program, 2, capturedOutputs, GL_INTERLEAVED_ATTRIBS);
+	glLinkProgram(program);
+	glDeleteShader(vertexShader);
+
+	int isLinked;
+	glGetProgramiv(program, GL_LINK_STATUS, &isLinked);
+	if (!isLinked)
+	{
+		char log[1024];
+		glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+		std::cout << "Could not link the shader: " << log << std::endl;
+
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+// Runs the program once for every point of the window and reads back what it produced
+static std::vector<float> capture_vertices(unsigned int program, const GridWindow& window)
+{
+	const int vertexCount = window.sampleSize * window.sampleSize;
+
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "sampleSize"), window.sampleSize);
+	glUniform1i(glGetUniformLocation(program, "firstRow"), window.firstRow);
+	glUniform1i(glGetUniformLocation(program, "firstColumn"), window.firstColumn);
+	glUniform1f(glGetUniformLocation(program, "spacing"), window.spacing);
+
+	unsigned int capture;
+	glCreateBuffers(1, &capture);
+	glNamedBufferStorage(capture, (GLsizeiptr)vertexCount * floatsPerVertex * sizeof(float), nullptr, 0);
+	glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, capture);
+
+	glEnable(GL_RASTERIZER_DISCARD);
+	glBeginTransformFeedback(GL_POINTS);
+	glDrawArraysInstancedBaseInstance(GL_POINTS, 0, vertexCount, 1, 0); // graph 0, whose model matrix is the identity
+	glEndTransformFeedback();
+	glDisable(GL_RASTERIZER_DISCARD);
+
+	std::vector<float> captured((size_t)vertexCount * floatsPerVertex);
+	glGetNamedBufferSubData(capture, 0, captured.size() * sizeof(float), captured.data());
+	glDeleteBuffers(1, &capture);
+
+	return captured;
+}
+
+static Differences compare(const std::vector<float>& captured, const std::vector<GraphVertex>& samples)
+{
+	Differences differences;
+	differences.points = (long long)samples.size();
+
+	for (size_t i = 0; i < samples.size(); i++)
+	{
+		const float* gpu = &captured[i * floatsPerVertex];
+		const GraphVertex& cpu = samples[i];
+
+		// vertices are placed at (x, z, y), see surface_vertex_shader.txt
+		const float gpuHeight = gpu[1];
+		const float cpuHeight = cpu.position.y;
+
+		// transforming an infinite height turns every component of gl_Position into nan, even with identity matrices, so at a pole
+		// only whether both sides found a height can be compared
+		if (!std::isfinite(gpuHeight) || !std::isfinite(cpuHeight))
+		{
+			if (std::isfinite(gpuHeight) != std::isfinite(cpuHeight)) differences.finiteMismatches++;
+			continue;
+		}
+
+		if (gpu[0] != cpu.position.x || gpu[2] != cpu.position.z) differences.positionMismatches++;
+
+		const double heightDifference = std::fabs((double)gpuHeight - cpuHeight) / std::max(1.0, (double)std::fabs(cpuHeight));
+		differences.relativeHeight = std::max(differences.relativeHeight, heightDifference);
+
+		for (int component = 0; component < 3; component++)
+		{
+			differences.normal = std::max(differences.normal, (double)std::fabs(gpu[4 + component] - cpu.normal[component]));
+		}
+	}
+
+	return differences;
+}
+
+int main(int argc, char** argv)
+{
+	const std::string path = argc > 1 ? argv[1] : "../PhysicsSimulationProject2/surface_vertex_shader.txt";
+
+	std::ifstream inputFile(path);
+	if (!inputFile.is_open())
+	{
+		std::cout << "Could not open " << path << std::endl;
+		return 1;
+	}
+	std::stringstream stream;
+	stream << inputFile.rdbuf();
+
+	if (!create_headless_context())
+	{
+		std::cout << "Could not create an OpenGL 4.5 or later context" << std::endl;
+		return 1;
+	}
+	std::cout << glGetString(GL_RENDERER) << ", OpenGL " << glGetString(GL_VERSION) << std::endl;
+
+	const std::string vertexTemplate = make_compatible(stream.str());
+
+	// every graph is drawn untransformed, so the captured gl_Position is the vertex itself
+	SceneUniforms scene = {};
+	scene.view = glm::mat4(1.f);
+	scene.projection = glm::mat4(1.f);
+	for (glm::mat4& model : scene.models) model = glm::mat4(1.f);
+
+	const unsigned int sceneBuffer = ShaderProgram::create_scene_buffer();
+	ShaderProgram::update_scene_buffer(sceneBuffer, scene);
+
+	unsigned int vao; // no attributes, but a vertex array must be bound to draw
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+
+	std::cout << std::left << std::setw(28) << "Expression" << std::right << std::setw(12) << "points" << std::setw(16) << "max z diff"
+		<< std::setw(16) << "max normal diff" << std::setw(12) << "positions" << std::setw(12) << "non-finite" << std::endl;
+
+	Differences total;
+	bool isEveryShaderBuilt = true;
+	bool isEveryExpressionMatching = true;
+
+	for (const CorpusEntry& entry : corpus)
+	{
+		const char* expression = entry.expression;
+
+		std::vector<Token> postfixExpression;
+		bool errorFlag = false;
+		InputHandler::verify_and_convert_function(expression, &postfixExpression, &errorFlag);
+		const ExpressionProgram program = ExpressionProgram::compile(postfixExpression, &errorFlag);
+
+		if (errorFlag)
+		{
+			std::cout << "Skipping invalid expression: " << expression << std::endl;
+			continue;
+		}
+
+		// each side is built exactly as GraphRebuilder and main build it, the GPU without row values
+		const ExpressionJit evaluator(ExpressionOptimiser::optimise(program, true));
+		const unsigned int capturingProgram = link_capturing_program(vertexTemplate + "\n" + SurfaceShader::generate_function(ExpressionOptimiser::optimise(program, false)));
+
+		if (capturingProgram == 0)
+		{
+			std::cout << "Could not build the shader for " << expression << std::endl;
+			isEveryShaderBuilt = false;
+			continue;
+		}
+
+		Differences differences;
+		for (int sampleSize : sampleSizes)
+		{
+			for (const GraphDomain& domain : domains)
+			{
+				const GridWindow window = GraphLogic::get_grid_window(domain, sampleSize);
+				differences.add(compare(capture_vertices(capturingProgram, window), GraphLogic::sample_points(evaluator, window)));
+			}
+		}
+		glDeleteProgram(capturingProgram);
+
+		std::cout << std::left << std::setw(28) << expression << std::right << std::setw(12) << differences.points << std::setw(16) << std::setprecision(3) << differences.relativeHeight
+			<< std::setw(16) << differences.normal << std::setw(12) << differences.positionMismatches << std::setw(12) << differences.finiteMismatches << std::endl;
+
+		const bool isMatching = differences.positionMismatches == 0 && differences.relativeHeight <= heightTolerance && differences.normal <= normalTolerance
+			&& (differences.finiteMismatches == 0 || entry.mayDifferInFiniteness);
+
+		if (!isMatching)
+		{
+			std::cout << "  the GPU does not match the CPU for " << expression << std::endl;
+			isEveryExpressionMatching = false;
+		}
+
+		total.add(differences);
+	}
+
+	std::cout << std::left << std::setw(28) << "All" << std::right << std::setw(12) << total.points << std::setw(16) << total.relativeHeight
+		<< std::setw(16) << total.normal << std::setw(12) << total.positionMismatches << std::setw(12) << total.finiteMismatches << std::endl;
+
+	glDeleteVertexArrays(1, &vao);
+	glDeleteBuffers(1, &sceneBuffer);
+
+	return isEveryShaderBuilt && isEveryExpressionMatching ? 0 : 1;
+}
@@ -0,0 +1,280 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+
+#include "InputHandler.h"
+#include "ExpressionProgram.h"
+#include "ExpressionJit.h"
+#include "ExpressionOptimiser.h"
+#include "ExpressionGroup.h"
+
+// Compares the throughput of the three ways of evaluating an expression (scalar interpreter, SIMD interpreter and JIT)
+// on the graphs saved by the visualiser, before and after the ExpressionOptimiser has been run.
+// Finally every graph is sampled at once, both separately and merged into an ExpressionGroup. Usage: GraphBenchmark [path to SavedGraphs.txt]
+
+static const int gridSize = 512; // the number of samples along each axis
+static const int repetitions = 20; // every evaluator is run this many times and the fastest run is kept
+
+template <typename Function>
+static double time_fastest_run(Function function)
+{
+	double fastest = 1e30;
+	for (int i = 0; i < repetitions; i++)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		function();
+		const auto end = std::chrono::steady_clock::now();
+
+		const double seconds = std::chrono::duration<double>(end - start).count();
+		if (seconds < fastest) fastest = seconds;
+	}
+	return fastest;
+}
+
+static void print_result(const std::string& name, double seconds)
+{
+	const double samplesPerSecond = (double)gridSize * gridSize / seconds;
+	std::cout << "  " << std::left << std::setw(26) << name << std::right << std::setw(10) << std::fixed << std::setprecision(2) << samplesPerSecond / 1e6 << " Msamples/s" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	const std::string path = argc > 1 ? argv[1] : "../PhysicsSimulationProject2/SavedGraphs.txt";
+
+	std::ifstream inputFile(path);
+	if (!inputFile.is_open())
+	{
+		std::cout << "Could not open " << path << std::endl;
+		return 1;
+	}
+
+	// The same sampling grid is used by every evaluator, laid out row by row as GraphLogic::sample_points does
+	std::vector<float> xs(gridSize * gridSize);
+	std::vector<float> ys(gridSize * gridSize);
+	for (int i = 0; i < gridSize; i++)
+	{
+		for (int j = 0; j < gridSize; j++)
+		{
+			xs[i * gridSize + j] = (i - gridSize / 2) / (gridSize / 10.f);
+			ys[i * gridSize + j] = (j - gridSize / 2) / (gridSize / 10.f);
+		}
+	}
+
+	std::vector<float> interpreterOutput(gridSize * gridSize);
+	std::vector<float> batchOutput(gridSize * gridSize);
+	std::vector<float> jitOutput(gridSize * gridSize);
+	std::vector<float> dzdxOutput(gridSize * gridSize);
+	std::vector<float> dzdyOutput(gridSize * gridSize);
+	std::vector<float> optimisedOutput(gridSize * gridSize);
+
+	std::vector<ExpressionProgram> groupPrograms; // every valid graph, optimised without row hoisting as GraphRebuilder does before grouping
+
+	std::vector<Token> postfixExpression;
+	std::string equation;
+	while (getline(inputFile, equation))
+	{
+		if (equation.length() == 0) continue;
+
+		bool errorFlag = false;
+		InputHandler::verify_and_convert_function(equation, &postfixExpression, &errorFlag);
+		const ExpressionProgram program = errorFlag ? ExpressionProgram() : ExpressionProgram::compile(postfixExpression, &errorFlag);
+
+		if (errorFlag || program.is_empty())
+		{
+			std::cout << "Skipping invalid expression: " << equation << std::endl;
+			continue;
+		}
+
+		const ExpressionJit jit(program);
+
+		OptimiserStatistics statistics;
+		const ExpressionProgram optimisedProgram = ExpressionOptimiser::optimise(program, true, &statistics);
+		const ExpressionJit optimisedJit(optimisedProgram);
+
+		groupPrograms.push_back(ExpressionOptimiser::optimise(program, false));
+
+		std::cout << equation << " (" << program.get_instructions().size() << " instructions)" << std::endl;
+
+		for (const OptimiserPassStatistics& pass : statistics.passes)
+		{
+			std::cout << "  " << std::left << std::setw(26) << pass.name << std::right << std::setw(4) << pass.instructionsBefore << " -> " << pass.instructionsAfter << " instructions" << std::endl;
+		}
+		std::cout << "  optimised program runs " << statistics.instructionsPerSample << " instructions per sample and " << statistics.instructionsPerRow << " per row" << std::endl;
+
+		print_result("interpreter", time_fastest_run([&]()
+		{
+			for (size_t i = 0; i < xs.size(); i++) interpreterOutput[i] = program.evaluate(xs[i], ys[i]);
+		}));
+
+		print_result("SIMD interpreter", time_fastest_run([&]()
+		{
+			for (int row = 0; row < gridSize; row++)
+			{
+				program.evaluate_batch(&xs[row * gridSize], &ys[row * gridSize], &batchOutput[row * gridSize], gridSize);
+			}
+		}));
+
+		// every row of the grid shares one x value, so the row values are prepared once per row as GraphLogic::sample_points does
+		print_result("optimised SIMD", time_fastest_run([&]()
+		{
+			ExpressionProgram::RowValues rowValues;
+			for (int row = 0; row < gridSize; row++)
+			{
+				optimisedProgram.prepare_row(xs[row * gridSize], &rowValues);
+				optimisedProgram.evaluate_batch(&xs[row * gridSize], &ys[row * gridSize], &optimisedOutput[row * gridSize], gridSize, &rowValues);
+			}
+		}));
+
+		// integer powers are multiplied out by the optimiser, so the results are allowed to differ by rounding
+		float largestOptimisedError = 0;
+		for (size_t i = 0; i < xs.size(); i++)
+		{
+			if (!std::isfinite(batchOutput[i])) continue;
+			const float error = std::fabs(optimisedOutput[i] - batchOutput[i]) / std::fmax(1.f, std::fabs(batchOutput[i]));
+			if (error > largestOptimisedError) largestOptimisedError = error;
+		}
+		std::cout << "  largest relative difference between optimised and original program: " << std::scientific << largestOptimisedError << std::endl;
+
+		// x takes the same values down the grid as y does across it, so one row of ys is also every row's x value
+		SeparableProgram separable;
+		if (ExpressionOptimiser::separate(program, &separable))
+		{
+			print_result("separable + gradient", time_fastest_run([&]()
+			{
+				std::vector<float> f(gridSize), dfdx(gridSize), g(gridSize), dgdy(gridSize), unused(gridSize);
+				separable.xPart.evaluate_batch_with_gradient(&ys[0], &ys[0], f.data(), dfdx.data(), unused.data(), gridSize);
+				separable.yPart.evaluate_batch_with_gradient(&ys[0], &ys[0], g.data(), unused.data(), dgdy.data(), gridSize);
+
+				for (int row = 0; row < gridSize; row++)
+				{
+					float* z = &optimisedOutput[row * gridSize];
+					float* dzdx = &dzdxOutput[row * gridSize];
+					float* dzdy = &dzdyOutput[row * gridSize];
+					const float fRow = f[row];
+					const float dfdxRow = dfdx[row];
+
+					if (separable.combine == OpCode::Multiply)
+					{
+						for (int j = 0; j < gridSize; j++)
+						{
+							z[j] = fRow * g[j];
+							dzdx[j] = dfdxRow * g[j];
+							dzdy[j] = fRow * dgdy[j];
+						}
+					}
+					else
+					{
+						for (int j = 0; j < gridSize; j++)
+						{
+							z[j] = fRow + g[j];
+							dzdx[j] = dfdxRow;
+							dzdy[j] = dgdy[j];
+						}
+					}
+				}
+			}));
+		}
+		else
+		{
+			std::cout << "  " << std::left << std::setw(26) << "separable" << "no, a term depends on both x and y" << std::endl;
+		}
+
+		if (!jit.is_compiled())
+		{
+			std::cout << "  " << std::left << std::setw(26) << "JIT" << "unavailable, " << (ExpressionJit::is_supported() ? "the expression cannot be compiled to native code" : "not supported on this platform") << std::endl;
+			continue;
+		}
+
+		print_result("JIT", time_fastest_run([&]()
+		{
+			for (int row = 0; row < gridSize; row++)
+			{
+				jit.evaluate_batch(&xs[row * gridSize], &ys[row * gridSize], &jitOutput[row * gridSize], gridSize);
+			}
+		}));
+
+		// The heights and both derivatives, as sampled by the visualiser to get its normals 
+		print_result("JIT + gradient", time_fastest_run([&]()
+		{
+			for (int row = 0; row < gridSize; row++)
+			{
+				const int first = row * gridSize;
+				jit.evaluate_batch_with_gradient(&xs[first], &ys[first], &jitOutput[first], &dzdxOutput[first], &dzdyOutput[first], gridSize);
+			}
+		}));
+
+		if (optimisedJit.is_gradient_compiled())
+		{
+			print_result("optimised JIT + gradient", time_fastest_run([&]()
+			{
+				ExpressionProgram::RowValues rowValues;
+				for (int row = 0; row < gridSize; row++)
+				{
+					const int first = row * gridSize;
+					optimisedJit.prepare_row(xs[first], &rowValues);
+					optimisedJit.evaluate_batch_with_gradient(&xs[first], &ys[first], &optimisedOutput[first], &dzdxOutput[first], &dzdyOutput[first], gridSize, &rowValues);
+				}
+			}));
+		}
+
+		// The JIT replaces pow with multiplications, so the results are allowed to differ by rounding 
+		float largestRelativeError = 0;
+		for (size_t i = 0; i < xs.size(); i++)
+		{
+			if (!std::isfinite(interpreterOutput[i])) continue;
+			const float error = std::fabs(jitOutput[i] - interpreterOutput[i]) / std::fmax(1.f, std::fabs(interpreterOutput[i]));
+			if (error > largestRelativeError) largestRelativeError = error;
+		}
+		std::cout << "  largest relative difference between JIT and interpreter: " << std::scientific << largestRelativeError << std::endl;
+	}
+
+	if (groupPrograms.size() > 1)
+	{
+		const ExpressionGroup group(groupPrograms);
+
+		std::cout << "All " << group.get_program_count() << " graphs (" << group.get_instruction_count() << " instructions, " << group.get_node_count() << " after merging)" << std::endl;
+
+		// the time to sample every graph, so the throughput is per grid point rather than per graph
+		print_result("separate SIMD + gradient", time_fastest_run([&]()
+		{
+			for (const ExpressionProgram& groupProgram : groupPrograms)
+			{
+				for (int row = 0; row < gridSize; row++)
+				{
+					const int first = row * gridSize;
+					groupProgram.evaluate_batch_with_gradient(&xs[first], &ys[first], &optimisedOutput[first], &dzdxOutput[first], &dzdyOutput[first], gridSize);
+				}
+			}
+		}));
+
+		if (group.is_valid())
+		{
+			std::vector<float> groupOutput(3 * groupPrograms.size() * gridSize);
+			std::vector<float*> outputs, dzdx, dzdy;
+			for (size_t i = 0; i < groupPrograms.size(); i++)
+			{
+				outputs.push_back(&groupOutput[(3 * i) * gridSize]);
+				dzdx.push_back(&groupOutput[(3 * i + 1) * gridSize]);
+				dzdy.push_back(&groupOutput[(3 * i + 2) * gridSize]);
+			}
+
+			print_result("grouped + gradient", time_fastest_run([&]()
+			{
+				for (int row = 0; row < gridSize; row++)
+				{
+					group.evaluate_row_with_gradient(xs[row * gridSize], &ys[0], gridSize, outputs.data(), dzdx.data(), dzdy.data());
+				}
+			}));
+		}
+		else
+		{
+			std::cout << "  the graphs need more than " << ExpressionGroup::maxSlots << " values at once, so they cannot be grouped" << std::endl;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,130 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "InputHandler.h"
+
+// Times InputHandler::verify_and_convert_function, which runs on every keystroke in a graph's text box, on inputs of every shape the
+// user can type, and counts the memory allocations each call makes. The output buffer is reused between calls, as the rebuild thread does. Results are written to standard output as JSON, like PipelineBenchmark.
+// Usage: ParserBenchmark [--runs N]
+
+static const int defaultRuns = 2000;
+
+// Every allocation in the program goes through these, so the allocations made by one call can be counted
+static std::atomic<long long> allocationCount(0);
+static std::atomic<long long> allocatedBytes(0);
+
+void* operator new(std::size_t size)
+{
+	allocationCount++;
+	allocatedBytes += (long long)size;
+
+	void* memory = std::malloc(size == 0 ? 1 : size);
+	if (memory == nullptr) throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+struct ParserCase
+{
+	std::string name;
+	std::string input;
+};
+
+static std::vector<ParserCase> make_cases()
+{
+	std::vector<ParserCase> cases;
+
+	cases.push_back({ "short", "x+y" });
+	cases.push_back({ "typical", "x^2+y^2" });
+	cases.push_back({ "implicit multiplication", "2xy(x+1)(y+2)3x^2y" });
+
+	std::string longInput = "x";
+	for (int term = 1; longInput.size() + 8 <= InputHandler::maxInputLength; term++) longInput += "+" + std::to_string(term % 9 + 1) + "*x^2*y";
+	cases.push_back({ "long", longInput });
+
+	std::string nestedInput = "x";
+	while (nestedInput.size() + 4 <= InputHandler::maxInputLength) nestedInput = "(" + nestedInput + "+y)";
+	cases.push_back({ "deeply nested", nestedInput });
+
+	cases.push_back({ "invalid", "(x+y))*2" }); // rejected at the unmatched parenthesis
+
+	return cases;
+}
+
+static double percentile(std::vector<double> values, double p) // nearest rank
+{
+	std::sort(values.begin(), values.end());
+
+	size_t rank = (size_t)(p / 100.0 * values.size() + 0.999999);
+	if (rank < 1) rank = 1;
+	if (rank > values.size()) rank = values.size();
+	return values[rank - 1];
+}
+
+int main(int argc, char** argv)
+{
+	int runs = defaultRuns;
+	if (argc > 2 && std::string(argv[1]) == "--runs") runs = std::max(1, std::atoi(argv[2]));
+
+	const std::vector<ParserCase> cases = make_cases();
+
+	std::ostringstream results; // printed once every case has run
+	results << "{\n  \"runs\": " << runs << ",\n  \"cases\": [";
+
+	for (size_t c = 0; c < cases.size(); c++)
+	{
+		const ParserCase& parserCase = cases[c];
+
+		std::vector<double> nanoseconds;
+		nanoseconds.reserve(runs); // reserved up front so that recording a time does not count as one of the parser's allocations
+
+		std::vector<Token> postfixExpression;
+		bool errorFlag = false;
+		size_t tokenCount = 0;
+		long long allocations = 0;
+		long long bytes = 0;
+
+		for (int run = 0; run < runs; run++)
+		{
+			errorFlag = false;
+
+			const long long allocationsBefore = allocationCount;
+			const long long bytesBefore = allocatedBytes;
+			const auto start = std::chrono::steady_clock::now();
+
+			InputHandler::verify_and_convert_function(parserCase.input, &postfixExpression, &errorFlag);
+
+			const auto end = std::chrono::steady_clock::now();
+			allocations = allocationCount - allocationsBefore; // the last call is reported, once the output buffer has grown
+			bytes = allocatedBytes - bytesBefore;
+			tokenCount = postfixExpression.size();
+
+			nanoseconds.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+		}
+
+		results << (c == 0 ? "\n" : ",\n") << "    { \"name\": \"" << parserCase.name << "\", \"length\": " << parserCase.input.size()
+			<< ", \"valid\": " << (errorFlag ? "false" : "true") << ", \"tokens\": " << tokenCount
+			<< ", \"p50_ns\": " << percentile(nanoseconds, 50) << ", \"p90_ns\": " << percentile(nanoseconds, 90) << ", \"p99_ns\": " << percentile(nanoseconds, 99)
+			<< ", \"allocations_per_call\": " << allocations << ", \"bytes_per_call\": " << bytes << " }";
+	}
+
+	results << "\n  ]\n}\n";
+	std::cout << results.str();
+	return 0;
+}
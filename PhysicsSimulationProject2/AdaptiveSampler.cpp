@@ -0,0 +1,356 @@
+#include "AdaptiveSampler.h"
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+	// the four directions to a neighbouring cell, in the order right, up, left, down
+	const int neighbourX[4] = { 1, 0, -1, 0 };
+	const int neighbourY[4] = { 0, 1, 0, -1 };
+}
+
+AdaptiveSampler::AdaptiveSampler(const ExpressionJit& evaluator, float tolerance, const GraphDomain& domain, const std::atomic<bool>* cancelFlag) :
+	mEvaluator_(evaluator),
+	mScale_(std::ldexp(1.f, domain.zoomLevel)),
+	mTolerance_(tolerance * mScale_), // the mesh is drawn scaled down by the zoom, so the tolerance is kept the same on screen
+	mCentreX_(domain.centreX),
+	mCentreY_(domain.centreY),
+	mCancelFlag_(cancelFlag)
+{
+}
+
+AdaptiveMesh AdaptiveSampler::sample(const ExpressionJit& evaluator, float tolerance, const GraphDomain& domain, const std::atomic<bool>* cancelFlag)
+{
+	if (evaluator.get_program().is_empty()) return {}; // the user entered an empty expression 
+
+	AdaptiveSampler sampler(evaluator, tolerance, domain, cancelFlag);
+
+	for (int ix = 0; ix < baseCells; ix++)
+	{
+		for (int iy = 0; iy < baseCells; iy++)
+		{
+			if (cancelFlag != nullptr && *cancelFlag) return {};
+			sampler.refine(0, ix, iy);
+		}
+	}
+
+	sampler.balance();
+
+	if (cancelFlag != nullptr && *cancelFlag) return {};
+
+	return sampler.triangulate();
+}
+
+AdaptiveSampler::Key AdaptiveSampler::node_key(int level, int ix, int iy)
+{
+	return ((Key)level << 48) | ((Key)ix << 24) | (Key)iy;
+}
+
+AdaptiveSampler::Key AdaptiveSampler::lattice_key(int i, int j)
+{
+	return ((Key)i << 24) | (Key)j;
+}
+
+int AdaptiveSampler::cell_width(int level)
+{
+	return latticeSize / (baseCells << level);
+}
+
+float AdaptiveSampler::lattice_coordinate(int i, float centre) const
+{
+	return centre + mScale_ * GraphLogic::domainWidth * ((float)i / latticeSize - 0.5f); // the lattice covers the same domain as the regular grid
+}
+
+Interval AdaptiveSampler::cell_bounds(int level, int ix, int iy) const
+{
+	const int width = cell_width(level);
+	const Interval x = { lattice_coordinate(ix * width, mCentreX_), lattice_coordinate((ix + 1) * width, mCentreX_) };
+	const Interval y = { lattice_coordinate(iy * width, mCentreY_), lattice_coordinate((iy + 1) * width, mCentreY_) };
+
+	return mEvaluator_.get_program().evaluate_interval(x, y);
+}
+
+const AdaptiveSampler::Sample& AdaptiveSampler::sample_lattice_point(int i, int j)
+{
+	const Key key = lattice_key(i, j);
+
+	std::unordered_map<Key, Sample>::iterator existingSample = mSamples_.find(key);
+	if (existingSample != mSamples_.end()) return existingSample->second;
+
+	const float x = lattice_coordinate(i, mCentreX_);
+	const float y = lattice_coordinate(j, mCentreY_);
+
+	Sample sample;
+	mEvaluator_.evaluate_batch_with_gradient(&x, &y, &sample.z, &sample.dzdx, &sample.dzdy, 1);
+
+	return mSamples_[key] = sample;
+}
+
+float AdaptiveSampler::evaluate_lattice_point(int i, int j)
+{
+	return sample_lattice_point(i, j).z;
+}
+
+/**
+ * \brief A cell is split if the surface does not look like a flat bilinear patch between its corners. The centre and edge midpoints are
+ * compared against the value predicted from the corners (a second difference), and the change across the cell (the gradient) is checked too.
+ * The cell's interval bounds are checked before any of this, as they can settle the question without taking any samples
+ */
+bool AdaptiveSampler::needs_refinement(int level, int ix, int iy)
+{
+	const Interval bounds = cell_bounds(level, ix, iy);
+
+	if (!bounds.is_bounded()) return true; // there may be a pole inside the cell, even if every sample we take misses it
+
+	// The surface and the flat patch drawn for the cell both lie within the bounds, so they can be no further apart than the bounds are wide
+	if (bounds.width() <= mTolerance_) return false;
+
+	if (bounds.lower > maxVisibleHeight * mScale_ || bounds.upper < -maxVisibleHeight * mScale_) return false; // the whole cell is out of view
+
+	const int width = cell_width(level);
+	const int i0 = ix * width;
+	const int j0 = iy * width;
+	const int half = width / 2;
+
+	const float corner00 = evaluate_lattice_point(i0, j0);
+	const float corner10 = evaluate_lattice_point(i0 + width, j0);
+	const float corner01 = evaluate_lattice_point(i0, j0 + width);
+	const float corner11 = evaluate_lattice_point(i0 + width, j0 + width);
+
+	const float centre = evaluate_lattice_point(i0 + half, j0 + half);
+	const float bottom = evaluate_lattice_point(i0 + half, j0);
+	const float top = evaluate_lattice_point(i0 + half, j0 + width);
+	const float left = evaluate_lattice_point(i0, j0 + half);
+	const float right = evaluate_lattice_point(i0 + width, j0 + half);
+
+	const float values[9] = { corner00, corner10, corner01, corner11, centre, bottom, top, left, right };
+	for (float value : values)
+	{
+		if (!std::isfinite(value)) return true; // a pole or a hole, which is refined as far as possible so that it stays narrow
+	}
+
+	float secondDifference = std::fabs(centre - (corner00 + corner10 + corner01 + corner11) / 4.f);
+	secondDifference = std::max(secondDifference, std::fabs(bottom - (corner00 + corner10) / 2.f));
+	secondDifference = std::max(secondDifference, std::fabs(top - (corner01 + corner11) / 2.f));
+	secondDifference = std::max(secondDifference, std::fabs(left - (corner00 + corner01) / 2.f));
+	secondDifference = std::max(secondDifference, std::fabs(right - (corner10 + corner11) / 2.f));
+
+	const float cellSize = mScale_ * GraphLogic::domainWidth * width / latticeSize;
+	const float smallest = std::min(std::min(corner00, corner10), std::min(corner01, corner11));
+	const float largest = std::max(std::max(corner00, corner10), std::max(corner01, corner11));
+
+	// a near vertical wall is split even if it looks flat, so that it is not drawn with long thin triangles
+	const bool isSteep = largest - smallest > maxSlope * cellSize && largest - smallest > mTolerance_;
+
+	return secondDifference > mTolerance_ || isSteep;
+}
+
+void AdaptiveSampler::refine(int level, int ix, int iy)
+{
+	if (level >= maxDepth || !needs_refinement(level, ix, iy)) return;
+
+	mSplitNodes_.insert(node_key(level, ix, iy));
+
+	for (int child = 0; child < 4; child++)
+	{
+		refine(level + 1, 2 * ix + (child & 1), 2 * iy + (child >> 1));
+	}
+}
+
+bool AdaptiveSampler::node_exists(int level, int ix, int iy) const
+{
+	const int cellsAcross = baseCells << level;
+	if (ix < 0 || iy < 0 || ix >= cellsAcross || iy >= cellsAcross) return false;
+
+	return level == 0 || is_split(level - 1, ix / 2, iy / 2);
+}
+
+bool AdaptiveSampler::is_split(int level, int ix, int iy) const
+{
+	return mSplitNodes_.count(node_key(level, ix, iy)) != 0;
+}
+
+/**
+ * \brief Splits cells until no leaf touches a leaf more than one level finer than itself, which guarantees that every leaf edge has at most one extra vertex on it
+ */
+void AdaptiveSampler::balance()
+{
+	struct Cell { int level; int ix; int iy; };
+	std::vector<Cell> cellsToCheck;
+
+	for (int ix = 0; ix < baseCells; ix++)
+	{
+		for (int iy = 0; iy < baseCells; iy++)
+		{
+			cellsToCheck.push_back({ 0, ix, iy });
+		}
+	}
+
+	while (!cellsToCheck.empty())
+	{
+		const Cell cell = cellsToCheck.back();
+		cellsToCheck.pop_back();
+
+		if (!node_exists(cell.level, cell.ix, cell.iy)) continue;
+
+		if (is_split(cell.level, cell.ix, cell.iy)) // only leaves are checked, so we move down to the children
+		{
+			for (int child = 0; child < 4; child++)
+			{
+				cellsToCheck.push_back({ cell.level + 1, 2 * cell.ix + (child & 1), 2 * cell.iy + (child >> 1) });
+			}
+			continue;
+		}
+
+		bool mustSplit = false;
+		for (int direction = 0; direction < 4 && !mustSplit; direction++)
+		{
+			const int nx = cell.ix + neighbourX[direction];
+			const int ny = cell.iy + neighbourY[direction];
+
+			if (!node_exists(cell.level, nx, ny) || !is_split(cell.level, nx, ny)) continue;
+
+			// the two children of the neighbour that share an edge with this cell
+			for (int k = 0; k < 2; k++)
+			{
+				const int childX = 2 * nx + (neighbourX[direction] != 0 ? (neighbourX[direction] > 0 ? 0 : 1) : k);
+				const int childY = 2 * ny + (neighbourY[direction] != 0 ? (neighbourY[direction] > 0 ? 0 : 1) : k);
+
+				if (is_split(cell.level + 1, childX, childY)) mustSplit = true;
+			}
+		}
+
+		if (!mustSplit) continue;
+
+		mSplitNodes_.insert(node_key(cell.level, cell.ix, cell.iy));
+
+		for (int child = 0; child < 4; child++)
+		{
+			cellsToCheck.push_back({ cell.level + 1, 2 * cell.ix + (child & 1), 2 * cell.iy + (child >> 1) });
+		}
+
+		// a coarser neighbouring leaf may now touch cells two levels finer than itself, so it has to be checked again
+		if (cell.level > 0)
+		{
+			for (int direction = 0; direction < 4; direction++)
+			{
+				cellsToCheck.push_back({ cell.level - 1, (cell.ix + neighbourX[direction]) >> 1, (cell.iy + neighbourY[direction]) >> 1 });
+			}
+		}
+	}
+}
+
+/**
+ * \brief A pole is only reported for the finest cells, when the interval bounds say the cell may contain one and the samples agree,
+ * either by not being finite or by jumping too far across the cell. The samples are needed because interval arithmetic can be
+ * pessimistic, e.g. x / x is unbounded across x = 0
+ */
+bool AdaptiveSampler::contains_pole(int level, int ix, int iy)
+{
+	if (level < maxDepth || cell_bounds(level, ix, iy).is_bounded()) return false;
+
+	const int width = cell_width(level);
+	const float corners[4] = {
+		evaluate_lattice_point(ix * width, iy * width),
+		evaluate_lattice_point((ix + 1) * width, iy * width),
+		evaluate_lattice_point(ix * width, (iy + 1) * width),
+		evaluate_lattice_point((ix + 1) * width, (iy + 1) * width) };
+
+	const float smallest = *std::min_element(corners, corners + 4);
+	const float largest = *std::max_element(corners, corners + 4);
+
+	return !std::isfinite(largest - smallest) || largest - smallest > maxSlope * mScale_ * GraphLogic::domainWidth * width / latticeSize;
+}
+
+AdaptiveMesh AdaptiveSampler::triangulate()
+{
+	AdaptiveMesh mesh;
+	std::unordered_map<Key, unsigned int> vertexIndices; // lattice points shared by several cells become a single vertex
+
+	auto get_vertex = [&](int i, int j) -> unsigned int
+	{
+		const Key key = lattice_key(i, j);
+
+		std::unordered_map<Key, unsigned int>::iterator existingVertex = vertexIndices.find(key);
+		if (existingVertex != vertexIndices.end()) return existingVertex->second;
+
+		const unsigned int index = (unsigned int)mesh.vertices.size();
+		const Sample& sample = sample_lattice_point(i, j);
+		mesh.vertices.push_back({ { lattice_coordinate(i, mCentreX_), sample.z, lattice_coordinate(j, mCentreY_) }, GraphLogic::surface_normal(sample.dzdx, sample.dzdy) }); // same layout as the grid, z is up 
+		vertexIndices[key] = index;
+		return index;
+	};
+
+	struct Cell { int level; int ix; int iy; };
+	std::vector<Cell> cellsToVisit;
+	for (int ix = 0; ix < baseCells; ix++)
+	{
+		for (int iy = 0; iy < baseCells; iy++)
+		{
+			cellsToVisit.push_back({ 0, ix, iy });
+		}
+	}
+
+	while (!cellsToVisit.empty())
+	{
+		const Cell cell = cellsToVisit.back();
+		cellsToVisit.pop_back();
+
+		if (is_split(cell.level, cell.ix, cell.iy))
+		{
+			for (int child = 0; child < 4; child++)
+			{
+				cellsToVisit.push_back({ cell.level + 1, 2 * cell.ix + (child & 1), 2 * cell.iy + (child >> 1) });
+			}
+			continue;
+		}
+
+		if (contains_pole(cell.level, cell.ix, cell.iy)) continue; // drawing it would give a spike towards infinity
+
+		const int width = cell_width(cell.level);
+		const int half = width / 2;
+		const int i0 = cell.ix * width;
+		const int j0 = cell.iy * width;
+
+		// The outline of the cell, anticlockwise from the bottom left corner. An edge gets a midpoint if the neighbour on the other side was split
+		const int cornerI[4] = { i0, i0 + width, i0 + width, i0 };
+		const int cornerJ[4] = { j0, j0, j0 + width, j0 + width };
+		const int edgeDirection[4] = { 3, 0, 1, 2 }; // the edge following each corner faces down, right, up and left
+
+		unsigned int outline[8];
+		int outlineSize = 0;
+
+		for (int corner = 0; corner < 4; corner++)
+		{
+			outline[outlineSize++] = get_vertex(cornerI[corner], cornerJ[corner]);
+
+			const int direction = edgeDirection[corner];
+			const int nx = cell.ix + neighbourX[direction];
+			const int ny = cell.iy + neighbourY[direction];
+
+			if (node_exists(cell.level, nx, ny) && is_split(cell.level, nx, ny))
+			{
+				const int next = (corner + 1) % 4;
+				outline[outlineSize++] = get_vertex((cornerI[corner] + cornerI[next]) / 2, (cornerJ[corner] + cornerJ[next]) / 2);
+			}
+		}
+
+		const unsigned int centre = get_vertex(i0 + half, j0 + half);
+
+		for (int k = 0; k < outlineSize; k++)
+		{
+			const unsigned int triangle[3] = { centre, outline[k], outline[(k + 1) % outlineSize] };
+
+			// triangles touching a pole are left out, rather than being drawn as a spike to infinity
+			bool isFinite = true;
+			for (unsigned int index : triangle)
+			{
+				isFinite = isFinite && std::isfinite(mesh.vertices[index].position.y);
+			}
+
+			if (isFinite) mesh.indices.insert(mesh.indices.end(), triangle, triangle + 3);
+		}
+	}
+
+	return mesh;
+}
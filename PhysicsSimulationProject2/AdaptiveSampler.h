@@ -0,0 +1,88 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <cstdint>
+
+#include "glm/glm.hpp"
+
+#include "ExpressionJit.h"
+#include "GraphLogic.h"
+
+// A mesh with its own triangle indices, unlike the regular grid meshes which share theirs
+struct AdaptiveMesh
+{
+	std::vector<GraphVertex> vertices;
+	std::vector<unsigned int> indices;
+};
+
+/**
+ * \brief Samples a graph over the same domain as GraphLogic::sample_points, but with a quadtree that is only refined where the surface bends
+ * sharply or changes quickly. Flat regions are covered by a few large triangles, while regions such as the area around the pole of 1/x
+ * are sampled as densely as a very fine grid. The tree is balanced so that neighbouring cells differ by at most one level, which lets
+ * every cell be triangulated as a fan that includes its neighbours' edge midpoints, so there are no cracks or T-junctions.
+ * Each cell is also bounded with interval arithmetic first, so cells that are provably flat or out of view are never refined, and
+ * the finest cells around a pole are found and left out even if no sample happens to land on it
+ */
+class AdaptiveSampler
+{
+public:
+	static const int baseCells = 8; // the number of cells along each axis before any refinement
+	static const int maxDepth = 6; // the most times a cell can be split, so the finest cells match a 512 * 512 grid
+	static constexpr float defaultTolerance = 0.02f;
+
+	/**
+	 * \brief Builds the adaptive mesh of a graph
+	 * \param evaluator - the compiled expression
+	 * \param tolerance - the largest distance allowed between the surface and the mesh at a cell's edge midpoints and centre, at zoom level 0
+	 * \param domain - the part of the plane to sample, the tolerance grows with the zoom so that the mesh looks as detailed at every level
+	 * \param cancelFlag - optional, if it becomes true the mesh stops being refined and the returned data must be ignored
+	 */
+	static AdaptiveMesh sample(const ExpressionJit& evaluator, float tolerance, const GraphDomain& domain, const std::atomic<bool>* cancelFlag = nullptr);
+
+private:
+	// every position used by the tree lies on a lattice this many points wide, so that vertices can be shared between cells
+	static const int latticeSize = baseCells << (maxDepth + 1);
+	static constexpr float maxSlope = 32.f; // cells whose height changes faster than this across their width are always split
+	static constexpr float maxVisibleHeight = 100.f; // the camera's far plane, cells entirely further from the graph's centre than this are not refined
+
+	typedef std::uint64_t Key;
+
+	static Key node_key(int level, int ix, int iy); // identifies a cell of the tree
+	static Key lattice_key(int i, int j); // identifies a point on the lattice
+	static int cell_width(int level); // the width of a cell in lattice units
+
+	float lattice_coordinate(int i, float centre) const; // converts a lattice position into a graph coordinate, centre is the domain's centre along the same axis
+
+	AdaptiveSampler(const ExpressionJit& evaluator, float tolerance, const GraphDomain& domain, const std::atomic<bool>* cancelFlag);
+
+	// The height and derivatives at a point on the lattice, both come from the same evaluation 
+	struct Sample
+	{
+		float z;
+		float dzdx;
+		float dzdy;
+	};
+
+	const Sample& sample_lattice_point(int i, int j); // each point is only evaluated once, however many cells share it
+	float evaluate_lattice_point(int i, int j); // the height at a point on the lattice
+	Interval cell_bounds(int level, int ix, int iy) const; // the range of heights the surface can reach inside a cell
+	bool needs_refinement(int level, int ix, int iy);
+	bool contains_pole(int level, int ix, int iy); // true for the finest cells which straddle a pole, these are not drawn
+	void refine(int level, int ix, int iy);
+	bool node_exists(int level, int ix, int iy) const;
+	bool is_split(int level, int ix, int iy) const;
+	void balance();
+	AdaptiveMesh triangulate();
+
+	const ExpressionJit& mEvaluator_;
+	const float mScale_; // how many times wider the domain is than at zoom level 0
+	const float mTolerance_;
+	const float mCentreX_;
+	const float mCentreY_;
+	const std::atomic<bool>* mCancelFlag_;
+
+	std::unordered_map<Key, Sample> mSamples_; // every lattice point that has been evaluated
+	std::unordered_set<Key> mSplitNodes_; // the cells that have been split into four children, every other existing cell is a leaf
+};
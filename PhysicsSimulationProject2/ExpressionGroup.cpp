@@ -0,0 +1,238 @@
+#include "ExpressionGroup.h"
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+ExpressionGroup::ExpressionGroup(const std::vector<ExpressionProgram>& programs) :
+	mInstructionCount_(0),
+	mSlotCount_(0)
+{
+	for (const ExpressionProgram& program : programs)
+	{
+		assert(!program.is_empty() && program.get_row_programs().empty());
+
+		std::vector<int> stack; // the node that pushed each value on the program's stack
+
+		for (const Instruction& instruction : program.get_instructions())
+		{
+			switch (instruction.opCode)
+			{
+			case OpCode::PushConstant:
+			case OpCode::PushX:
+			case OpCode::PushY:
+				stack.push_back(add_node(instruction, -1, -1));
+				break;
+			case OpCode::IntegerPower:
+				stack.back() = add_node(instruction, stack.back(), -1);
+				break;
+			default:
+			{
+				const int right = stack.back();
+				stack.pop_back();
+				stack.back() = add_node(instruction, stack.back(), right);
+				break;
+			}
+			}
+		}
+
+		assert(stack.size() == 1);
+		mOutputs_.push_back(stack.back());
+		mInstructionCount_ += (int)program.get_instructions().size();
+	}
+
+	mNodeLookup_.clear(); // only needed while merging
+
+	assign_slots();
+}
+
+int ExpressionGroup::add_node(const Instruction& instruction, int left, int right)
+{
+	// a + b and b + a give exactly the same result, so the operands are ordered to let both forms match
+	if ((instruction.opCode == OpCode::Add || instruction.opCode == OpCode::Multiply) && right < left) std::swap(left, right);
+
+	// constants are compared by their bits, so 0 and -0 are kept apart
+	unsigned int constantBits = 0;
+	if (instruction.opCode == OpCode::PushConstant) std::memcpy(&constantBits, &instruction.constant, sizeof(constantBits));
+
+	const int operand = instruction.opCode == OpCode::IntegerPower ? instruction.operand : 0;
+
+	const std::tuple<int, unsigned int, int, int, int> key((int)instruction.opCode, constantBits, operand, left, right);
+
+	auto existing = mNodeLookup_.find(key);
+	if (existing != mNodeLookup_.end()) return existing->second; // this subexpression has already been calculated by an earlier program
+
+	Node node = { instruction, left, right, instruction.opCode != OpCode::PushY, -1 };
+	if (left != -1) node.isRowInvariant = mNodes_[left].isRowInvariant && (right == -1 || mNodes_[right].isRowInvariant);
+
+	mNodes_.push_back(node);
+	mNodeLookup_[key] = (int)mNodes_.size() - 1;
+
+	return (int)mNodes_.size() - 1;
+}
+
+void ExpressionGroup::assign_slots()
+{
+	const int nodeCount = (int)mNodes_.size();
+
+	// the last node that reads each node, the outputs are read once every node has been evaluated
+	std::vector<int> lastUse(nodeCount, -1);
+	for (int i = 0; i < nodeCount; i++)
+	{
+		if (mNodes_[i].left != -1) lastUse[mNodes_[i].left] = i;
+		if (mNodes_[i].right != -1) lastUse[mNodes_[i].right] = i;
+	}
+	for (int output : mOutputs_) lastUse[output] = nodeCount;
+
+	std::vector<int> freeSlots; // slots that held values recalculated for every batch, which are no longer needed
+
+	for (int i = 0; i < nodeCount; i++)
+	{
+		Node& node = mNodes_[i];
+
+		// Row invariant values are read again by every later batch of the row, so their slots are never reused.
+		// Any other value that nothing reads afterwards is overwritten in place
+		if (!node.isRowInvariant && node.left != -1 && lastUse[node.left] == i && !mNodes_[node.left].isRowInvariant)
+		{
+			node.slot = mNodes_[node.left].slot;
+		}
+		else if (!node.isRowInvariant && !freeSlots.empty())
+		{
+			node.slot = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else
+		{
+			node.slot = mSlotCount_++;
+		}
+
+		// the operands are only released after the node has its slot, so evaluating it never overwrites an operand it still needs
+		for (int operand : { node.left, node.right })
+		{
+			if (operand == -1 || lastUse[operand] != i || mNodes_[operand].isRowInvariant) continue;
+			if (mNodes_[operand].slot == node.slot) continue; // taken over by this node
+			if (operand == node.right && node.right == node.left) continue; // released once already
+
+			freeSlots.push_back(mNodes_[operand].slot);
+		}
+	}
+}
+
+bool ExpressionGroup::is_valid() const
+{
+	return mSlotCount_ <= maxSlots;
+}
+
+int ExpressionGroup::get_program_count() const
+{
+	return (int)mOutputs_.size();
+}
+
+int ExpressionGroup::get_node_count() const
+{
+	return (int)mNodes_.size();
+}
+
+int ExpressionGroup::get_instruction_count() const
+{
+	return mInstructionCount_;
+}
+
+void ExpressionGroup::evaluate_row_with_gradient(float x, const float* y, int count, float* const* output, float* const* dzdx, float* const* dzdy) const
+{
+	assert(is_valid());
+
+	const int batchSize = ExpressionProgram::batchSize;
+	ExpressionProgram::DualBatch slots[maxSlots]; // fixed size, so no memory is allocated per row
+
+	evaluate_row_invariant_nodes(x, slots); // held for every batch of the row
+
+	for (int i = 0; i < count; i += batchSize)
+	{
+		const int remaining = std::min(batchSize, count - i);
+
+		if (remaining == batchSize)
+		{
+			evaluate_full_batch(y + i, slots);
+		}
+		else // the final batch is only partially full, so it is padded with copies of the last point as ExpressionProgram::evaluate_batch does
+		{
+			alignas(32) float yPadded[batchSize];
+			for (int j = 0; j < batchSize; j++) yPadded[j] = y[i + std::min(j, remaining - 1)];
+
+			evaluate_full_batch(yPadded, slots);
+		}
+
+		for (size_t program = 0; program < mOutputs_.size(); program++)
+		{
+			const ExpressionProgram::DualBatch& result = slots[mNodes_[mOutputs_[program]].slot];
+
+			std::copy(result.value, result.value + remaining, output[program] + i);
+			std::copy(result.dx, result.dx + remaining, dzdx[program] + i);
+			std::copy(result.dy, result.dy + remaining, dzdy[program] + i);
+		}
+	}
+}
+
+void ExpressionGroup::evaluate_row_invariant_nodes(float x, ExpressionProgram::DualBatch* slots) const
+{
+	const int batchSize = ExpressionProgram::batchSize;
+
+	for (const Node& node : mNodes_)
+	{
+		if (!node.isRowInvariant) continue;
+
+		ExpressionProgram::DualBatch& result = slots[node.slot];
+
+		switch (node.instruction.opCode)
+		{
+		case OpCode::PushConstant:
+			std::fill(result.value, result.value + batchSize, node.instruction.constant);
+			std::fill(result.dx, result.dx + batchSize, 0.f);
+			std::fill(result.dy, result.dy + batchSize, 0.f);
+			break;
+		case OpCode::PushX:
+			std::fill(result.value, result.value + batchSize, x);
+			std::fill(result.dx, result.dx + batchSize, 1.f);
+			std::fill(result.dy, result.dy + batchSize, 0.f);
+			break;
+		default:
+			apply_node(node, slots);
+			break;
+		}
+	}
+}
+
+void ExpressionGroup::evaluate_full_batch(const float* y, ExpressionProgram::DualBatch* slots) const
+{
+	const int batchSize = ExpressionProgram::batchSize;
+
+	for (const Node& node : mNodes_)
+	{
+		if (node.isRowInvariant) continue; // still held from the start of the row
+
+		ExpressionProgram::DualBatch& result = slots[node.slot];
+
+		switch (node.instruction.opCode)
+		{
+		case OpCode::PushY:
+			std::copy(y, y + batchSize, result.value);
+			std::fill(result.dx, result.dx + batchSize, 0.f);
+			std::fill(result.dy, result.dy + batchSize, 1.f);
+			break;
+		default:
+			apply_node(node, slots);
+			break;
+		}
+	}
+}
+
+void ExpressionGroup::apply_node(const Node& node, ExpressionProgram::DualBatch* slots) const
+{
+	ExpressionProgram::DualBatch& result = slots[node.slot];
+
+	const ExpressionProgram::DualBatch& left = slots[mNodes_[node.left].slot];
+	if (&left != &result) result = left;
+
+	const int right = node.right == -1 ? node.left : node.right; // ignored by OpCode::IntegerPower
+	ExpressionProgram::apply_dual_operation(node.instruction, result, slots[mNodes_[right].slot]);
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <tuple>
+
+#include "ExpressionProgram.h"
+
+/**
+ * \brief Several programs merged into one graph of operations, in which every distinct subexpression appears only once.
+ * Evaluating the group calculates every program at the same points, so graphs that share work (f, f + 1, 2f, f - g ...) only pay for it once.
+ * Operations that do not depend on y are only calculated once for every row of samples
+ */
+class ExpressionGroup
+{
+public:
+	static constexpr int maxSlots = 256; // the most values that can be held at once while evaluating, groups needing more are not valid
+
+	/**
+	 * \brief Merges programs, subexpressions are matched exactly, after the operands of + and * have been put in a fixed order
+	 * \param programs - the programs to merge, none of them may be empty or have row programs
+	 */
+	explicit ExpressionGroup(const std::vector<ExpressionProgram>& programs);
+
+	bool is_valid() const; // false if the group needs more than maxSlots values at once, in which case it must not be evaluated
+	int get_program_count() const;
+	int get_node_count() const; // the number of distinct operations, which is roughly the work done at every point
+	int get_instruction_count() const; // the total number of instructions in the programs before they were merged
+
+	/**
+	 * \brief Evaluates every program along one row of samples that share the same x value, along with the partial derivatives
+	 * \param x - the x coordinate shared by every point in the row
+	 * \param y - the y coordinate of every point
+	 * \param count - the number of points, does not need to be a multiple of ExpressionProgram::batchSize
+	 * \param output - for every program, where the z value at every point is written, each must have space for count floats
+	 * \param dzdx - the same, for the derivative with respect to x
+	 * \param dzdy - the same, for the derivative with respect to y
+	 */
+	void evaluate_row_with_gradient(float x, const float* y, int count, float* const* output, float* const* dzdx, float* const* dzdy) const;
+
+private:
+	struct Node
+	{
+		Instruction instruction;
+		int left; // the nodes holding the operands, -1 for instructions that push a value
+		int right; // -1 unless the instruction is a binary operator
+		bool isRowInvariant; // true if the node does not depend on y, so it keeps the same value along a row
+		int slot; // where the node's value is held while evaluating
+	};
+
+	int add_node(const Instruction& instruction, int left, int right); // returns the existing node if an identical one was already added
+	void assign_slots(); // gives every node a slot, reusing the slots of values that are no longer needed
+
+	void evaluate_row_invariant_nodes(float x, ExpressionProgram::DualBatch* slots) const; // evaluates the nodes that keep their value along a row
+	void evaluate_full_batch(const float* y, ExpressionProgram::DualBatch* slots) const; // evaluates every node that depends on y for one batch of points
+	void apply_node(const Node& node, ExpressionProgram::DualBatch* slots) const; // evaluates a node that is an operation
+
+	std::vector<Node> mNodes_; // every node comes after its operands, so they can be evaluated in order
+	std::vector<int> mOutputs_; // the node holding the result of every program
+	std::map<std::tuple<int, unsigned int, int, int, int>, int> mNodeLookup_; // finds identical nodes while the group is built, by opcode, constant bits, operand and operands
+	int mInstructionCount_;
+	int mSlotCount_;
+};
@@ -0,0 +1,560 @@
+#include "ExpressionJit.h"
+#include <cstring>
+#include <cmath>
+#include <cstddef>
+
+#if defined(__linux__) && defined(__x86_64__)
+#define EXPRESSION_JIT_AVAILABLE
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+	// A tiny x86-64 assembler, only the handful of instructions that the generated code needs are supported.
+	// Registers are numbered 0 - 15, registers 8 - 15 need a REX prefix
+
+	enum GeneralRegister : unsigned char { RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7, R8 = 8, R9 = 9, R10 = 10 };
+
+	// packed single precision SSE opcodes, all of them follow the 0x0F escape byte
+	enum SseOpcode : unsigned char { MOVUPS_LOAD = 0x10, MOVUPS_STORE = 0x11, MOVAPS = 0x28, ADDPS = 0x58, MULPS = 0x59, SUBPS = 0x5C, DIVPS = 0x5E, XORPS = 0x57 };
+
+	void emit_byte(std::vector<unsigned char>& code, unsigned char byte)
+	{
+		code.push_back(byte);
+	}
+
+	void emit_int32(std::vector<unsigned char>& code, int value)
+	{
+		unsigned char bytes[4];
+		std::memcpy(bytes, &value, 4); // x86 is little endian, so the bytes are already in the right order
+		code.insert(code.end(), bytes, bytes + 4);
+	}
+
+	void emit_rex_if_needed(std::vector<unsigned char>& code, int reg, int rm)
+	{
+		if (reg >= 8 || rm >= 8)
+		{
+			emit_byte(code, 0x40 | ((reg >= 8) << 2) | (rm >= 8));
+		}
+	}
+
+	// op xmmDestination, xmmSource
+	void emit_register_operation(std::vector<unsigned char>& code, SseOpcode opcode, int destination, int source)
+	{
+		emit_rex_if_needed(code, destination, source);
+		emit_byte(code, 0x0F);
+		emit_byte(code, opcode);
+		emit_byte(code, 0xC0 | ((destination & 7) << 3) | (source & 7));
+	}
+
+	// movups xmmDestination, [base + rax * 4]
+	void emit_load_indexed(std::vector<unsigned char>& code, int destination, GeneralRegister base)
+	{
+		emit_rex_if_needed(code, destination, 0);
+		emit_byte(code, 0x0F);
+		emit_byte(code, MOVUPS_LOAD);
+		emit_byte(code, 0x04 | ((destination & 7) << 3)); // the address is described by the following SIB byte
+		emit_byte(code, 0x80 | (RAX << 3) | base); // scale of 4, index rax
+	}
+
+	// movups [base + rax * 4], xmmSource
+	void emit_store_indexed(std::vector<unsigned char>& code, int source, GeneralRegister base)
+	{
+		emit_rex_if_needed(code, source, base);
+		emit_byte(code, 0x0F);
+		emit_byte(code, MOVUPS_STORE);
+		emit_byte(code, 0x04 | ((source & 7) << 3));
+		emit_byte(code, 0x80 | (RAX << 3) | (base & 7));
+	}
+
+	// movups xmmDestination, [base + displacement]
+	void emit_load_displaced(std::vector<unsigned char>& code, int destination, GeneralRegister base, int displacement)
+	{
+		emit_rex_if_needed(code, destination, base);
+		emit_byte(code, 0x0F);
+		emit_byte(code, MOVUPS_LOAD);
+		emit_byte(code, 0x80 | ((destination & 7) << 3) | (base & 7)); // a 32 bit displacement follows
+		emit_int32(code, displacement);
+	}
+
+	// mov r10, [rsp + 8] - the seventh argument is passed on the stack, just above the return address
+	void emit_load_seventh_argument_into_r10(std::vector<unsigned char>& code)
+	{
+		emit_byte(code, 0x4C);
+		emit_byte(code, 0x8B);
+		emit_byte(code, 0x54);
+		emit_byte(code, 0x24);
+		emit_byte(code, 0x08);
+	}
+
+	// offsets of a row value and its derivative within ExpressionProgram::RowValues
+	int row_value_offset(int index)
+	{
+		return (int)(offsetof(ExpressionProgram::RowValues, value) + index * sizeof(float[4]));
+	}
+
+	int row_derivative_offset(int index)
+	{
+		return (int)(offsetof(ExpressionProgram::RowValues, dx) + index * sizeof(float[4]));
+	}
+
+	// movups xmmDestination, [rip + displacement], returns the position of the displacement so it can be patched later
+	size_t emit_load_rip_relative(std::vector<unsigned char>& code, int destination)
+	{
+		emit_rex_if_needed(code, destination, 0);
+		emit_byte(code, 0x0F);
+		emit_byte(code, MOVUPS_LOAD);
+		emit_byte(code, 0x05 | ((destination & 7) << 3));
+		const size_t displacementPosition = code.size();
+		emit_int32(code, 0);
+		return displacementPosition;
+	}
+
+	void patch_int32(std::vector<unsigned char>& code, size_t position, int value)
+	{
+		std::memcpy(code.data() + position, &value, 4);
+	}
+
+	// a constant that the code reads from the pool placed after the code
+	struct ConstantReference
+	{
+		size_t displacementPosition;
+		float value;
+	};
+
+	bool is_small_integer(float value, int limit)
+	{
+		return value == std::floor(value) && std::fabs(value) <= limit;
+	}
+
+	// xor eax, eax / loopStart: cmp rax, rcx / jae done - rax is the index of the current group of four points
+	size_t emit_loop_start(std::vector<unsigned char>& code, size_t* exitJumpPosition)
+	{
+		emit_byte(code, 0x31);
+		emit_byte(code, 0xC0);
+
+		const size_t loopStart = code.size();
+
+		emit_byte(code, 0x48);
+		emit_byte(code, 0x39);
+		emit_byte(code, 0xC8);
+		emit_byte(code, 0x0F);
+		emit_byte(code, 0x83);
+		*exitJumpPosition = code.size();
+		emit_int32(code, 0);
+
+		return loopStart;
+	}
+
+	// add rax, 4 / jmp loopStart / done: ret
+	void emit_loop_end(std::vector<unsigned char>& code, size_t loopStart, size_t exitJumpPosition)
+	{
+		emit_byte(code, 0x48);
+		emit_byte(code, 0x83);
+		emit_byte(code, 0xC0);
+		emit_byte(code, 0x04);
+		emit_byte(code, 0xE9);
+		emit_int32(code, (int)loopStart - (int)(code.size() + 4));
+
+		patch_int32(code, exitJumpPosition, (int)code.size() - (int)(exitJumpPosition + 4));
+		emit_byte(code, 0xC3);
+	}
+
+	// The constant pool, each constant is repeated four times so that it can be loaded straight into a whole register
+	void emit_constant_pool(std::vector<unsigned char>& code, const std::vector<ConstantReference>& constants)
+	{
+		while (code.size() % 16 != 0) emit_byte(code, 0xCC);
+
+		for (const ConstantReference& constant : constants)
+		{
+			int bits;
+			std::memcpy(&bits, &constant.value, 4);
+
+			patch_int32(code, constant.displacementPosition, (int)code.size() - (int)(constant.displacementPosition + 4));
+			for (int lane = 0; lane < 4; lane++) emit_int32(code, bits);
+		}
+	}
+
+	// Multiplies register destination by base^exponent, using scratch as a copy of the base. Exponentiation by squaring, working from the most significant bit down
+	void emit_integer_power(std::vector<unsigned char>& code, std::vector<ConstantReference>& constants, int destination, int scratch, int exponent)
+	{
+		if (exponent == 0)
+		{
+			constants.push_back({ emit_load_rip_relative(code, destination), 1.f });
+			return;
+		}
+
+		const int magnitude = exponent < 0 ? -exponent : exponent;
+		emit_register_operation(code, MOVAPS, scratch, destination);
+
+		int highestBit = 0;
+		while ((magnitude >> (highestBit + 1)) != 0) highestBit++;
+
+		for (int bit = highestBit - 1; bit >= 0; bit--)
+		{
+			emit_register_operation(code, MULPS, destination, destination);
+			if ((magnitude >> bit) & 1) emit_register_operation(code, MULPS, destination, scratch);
+		}
+
+		if (exponent < 0) // x^-n = 1 / x^n
+		{
+			constants.push_back({ emit_load_rip_relative(code, scratch), 1.f });
+			emit_register_operation(code, DIVPS, scratch, destination);
+			emit_register_operation(code, MOVAPS, destination, scratch);
+		}
+	}
+
+	// (a, a') ^ n = (a^n, n a^(n - 1) a') for the dual number in slot, the three registers of slot scratch are overwritten
+	void emit_dual_integer_power(std::vector<unsigned char>& code, std::vector<ConstantReference>& constants, int slot, int scratch, int exponent)
+	{
+		const int value = 3 * slot;
+		const int dx = 3 * slot + 1;
+		const int dy = 3 * slot + 2;
+
+		if (exponent == 0) // a constant 1
+		{
+			constants.push_back({ emit_load_rip_relative(code, value), 1.f });
+			emit_register_operation(code, XORPS, dx, dx);
+			emit_register_operation(code, XORPS, dy, dy);
+		}
+		else if (exponent != 1)
+		{
+			// scratch + 1 ends up holding a^(n - 1), which is only used for the derivative
+			emit_register_operation(code, MOVAPS, 3 * scratch + 1, value);
+			emit_integer_power(code, constants, 3 * scratch + 1, 3 * scratch, exponent - 1);
+
+			constants.push_back({ emit_load_rip_relative(code, 3 * scratch + 2), (float)exponent });
+			emit_register_operation(code, MULPS, 3 * scratch + 2, 3 * scratch + 1);
+			emit_register_operation(code, MULPS, dx, 3 * scratch + 2);
+			emit_register_operation(code, MULPS, dy, 3 * scratch + 2);
+
+			// a^n gets its own multiplications rather than a^(n - 1) a, so it rounds as the interpreter does and 0^-n is inf rather than inf * 0
+			emit_integer_power(code, constants, value, 3 * scratch, exponent);
+		}
+	}
+}
+
+ExpressionJit::ExpressionJit(const ExpressionProgram& program) :
+	mProgram_(program),
+	mExecutableMemory_(nullptr),
+	mExecutableSize_(0),
+	mFunction_(nullptr),
+	mGradientFunction_(nullptr)
+{
+	if (!is_supported() || mProgram_.is_empty()) return; // the interpreter will be used
+
+	// Both functions are generated up front and share one block of executable memory, either can fail on its own
+	std::vector<unsigned char> code;
+	std::vector<unsigned char> gradientCode;
+
+	if (!generate_code(code)) code.clear();
+	if (!generate_gradient_code(gradientCode)) gradientCode.clear();
+
+	make_executable(code, gradientCode);
+}
+
+ExpressionJit::~ExpressionJit()
+{
+#ifdef EXPRESSION_JIT_AVAILABLE
+	if (mExecutableMemory_ != nullptr)
+	{
+		munmap(mExecutableMemory_, mExecutableSize_);
+	}
+#endif
+}
+
+bool ExpressionJit::is_supported()
+{
+#ifdef EXPRESSION_JIT_AVAILABLE
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool ExpressionJit::is_compiled() const
+{
+	return mFunction_ != nullptr;
+}
+
+bool ExpressionJit::is_gradient_compiled() const
+{
+	return mGradientFunction_ != nullptr;
+}
+
+const ExpressionProgram& ExpressionJit::get_program() const
+{
+	return mProgram_;
+}
+
+void ExpressionJit::prepare_row(float x, ExpressionProgram::RowValues* rowValues) const
+{
+	mProgram_.prepare_row(x, rowValues);
+}
+
+void ExpressionJit::evaluate_batch(const float* x, const float* y, float* output, int count, const ExpressionProgram::RowValues* rowValues) const
+{
+	// the generated code reads row values from memory, so it cannot run the row programs for every point itself
+	if (mFunction_ == nullptr || (rowValues == nullptr && !mProgram_.get_row_programs().empty()))
+	{
+		mProgram_.evaluate_batch(x, y, output, count, rowValues);
+		return;
+	}
+
+	const int nativeCount = count & ~3; // the generated code works in groups of four
+	mFunction_(x, y, output, nativeCount, rowValues);
+
+	if (nativeCount < count)
+	{
+		mProgram_.evaluate_batch(x + nativeCount, y + nativeCount, output + nativeCount, count - nativeCount, rowValues);
+	}
+}
+
+void ExpressionJit::evaluate_batch_with_gradient(const float* x, const float* y, float* output, float* dzdx, float* dzdy, int count, const ExpressionProgram::RowValues* rowValues) const
+{
+	if (mGradientFunction_ == nullptr || (rowValues == nullptr && !mProgram_.get_row_programs().empty()))
+	{
+		mProgram_.evaluate_batch_with_gradient(x, y, output, dzdx, dzdy, count, rowValues);
+		return;
+	}
+
+	const int nativeCount = count & ~3;
+	mGradientFunction_(x, y, output, nativeCount, dzdx, dzdy, rowValues);
+
+	if (nativeCount < count)
+	{
+		mProgram_.evaluate_batch_with_gradient(x + nativeCount, y + nativeCount, output + nativeCount, dzdx + nativeCount, dzdy + nativeCount, count - nativeCount, rowValues);
+	}
+}
+
+/**
+ * \brief Generates a function with the signature of CompiledFunction (System V calling convention, so x = rdi, y = rsi, output = rdx, count = rcx and rowValues = r8)
+ * Stack slot i of the program lives in register xmmi, so the program never touches memory apart from reading x and y and writing the result
+ * \param code - the machine code is appended to this
+ * \return false if the program needs more registers than exist, or uses a power that is not a small constant integer
+ */
+bool ExpressionJit::generate_code(std::vector<unsigned char>& code) const
+{
+	if (mProgram_.get_stack_depth() > registerCount) return false;
+
+	const std::vector<Instruction>& instructions = mProgram_.get_instructions();
+	std::vector<ConstantReference> constants;
+
+	size_t exitJumpPosition;
+	const size_t loopStart = emit_loop_start(code, &exitJumpPosition);
+
+	int top = -1; // the register holding the top of the stack
+
+	for (size_t i = 0; i < instructions.size(); i++)
+	{
+		const Instruction& instruction = instructions[i];
+
+		switch (instruction.opCode)
+		{
+		case OpCode::PushConstant:
+			top++;
+			// a constant integer exponent is folded into the power itself, so it does not need to be loaded
+			if (i + 1 < instructions.size() && instructions[i + 1].opCode == OpCode::Power && is_small_integer(instruction.constant, maxIntegerPower)) break;
+			constants.push_back({ emit_load_rip_relative(code, top), instruction.constant });
+			break;
+		case OpCode::PushX:
+			emit_load_indexed(code, ++top, RDI);
+			break;
+		case OpCode::PushY:
+			emit_load_indexed(code, ++top, RSI);
+			break;
+		case OpCode::Add:
+			emit_register_operation(code, ADDPS, top - 1, top);
+			top--;
+			break;
+		case OpCode::Subtract:
+			emit_register_operation(code, SUBPS, top - 1, top);
+			top--;
+			break;
+		case OpCode::Multiply:
+			emit_register_operation(code, MULPS, top - 1, top);
+			top--;
+			break;
+		case OpCode::Divide:
+			emit_register_operation(code, DIVPS, top - 1, top);
+			top--;
+			break;
+		case OpCode::Power:
+		{
+			const Instruction& exponentInstruction = instructions[i - 1];
+			if (exponentInstruction.opCode != OpCode::PushConstant || !is_small_integer(exponentInstruction.constant, maxIntegerPower))
+			{
+				return false; // pow with a variable or fractional exponent has no SSE equivalent
+			}
+
+			// the exponent was never loaded, so its register is free to hold a copy of the base
+			emit_integer_power(code, constants, top - 1, top, (int)exponentInstruction.constant);
+			top--;
+			break;
+		}
+		case OpCode::IntegerPower:
+			if (top + 1 >= registerCount) return false; // the copy of the base needs a free register
+			emit_integer_power(code, constants, top, top + 1, instruction.operand);
+			break;
+		case OpCode::PushRowValue:
+			emit_load_displaced(code, ++top, R8, row_value_offset(instruction.operand));
+			break;
+		}
+	}
+
+	emit_store_indexed(code, 0, RDX);
+	emit_loop_end(code, loopStart, exitJumpPosition);
+	emit_constant_pool(code, constants);
+
+	return true;
+}
+
+/**
+ * \brief Generates a function with the signature of GradientFunction, where dzdx = r8, dzdy = r9 and rowValues is loaded into r10 from the stack.
+ * Every stack slot is a dual number held in three registers, the value in xmm(3i) and its derivatives with respect to x and y in xmm(3i + 1) and xmm(3i + 2)
+ * \param code - the machine code is appended to this
+ * \return false if the program needs more registers than exist, or uses a power that is not a small constant integer
+ */
+bool ExpressionJit::generate_gradient_code(std::vector<unsigned char>& code) const
+{
+	if (mProgram_.get_stack_depth() > registerCount / 3) return false;
+
+	const std::vector<Instruction>& instructions = mProgram_.get_instructions();
+	std::vector<ConstantReference> constants;
+
+	emit_load_seventh_argument_into_r10(code);
+
+	size_t exitJumpPosition;
+	const size_t loopStart = emit_loop_start(code, &exitJumpPosition);
+
+	int top = -1; // the slot holding the top of the stack
+
+	auto value = [](int slot) { return 3 * slot; };
+	auto dx = [](int slot) { return 3 * slot + 1; };
+	auto dy = [](int slot) { return 3 * slot + 2; };
+
+	for (size_t i = 0; i < instructions.size(); i++)
+	{
+		const Instruction& instruction = instructions[i];
+		const int a = top - 1; // the operands of a binary operation, the result replaces a
+		const int b = top;
+
+		switch (instruction.opCode)
+		{
+		case OpCode::PushConstant:
+			top++;
+			if (i + 1 < instructions.size() && instructions[i + 1].opCode == OpCode::Power && is_small_integer(instruction.constant, maxIntegerPower)) break;
+			constants.push_back({ emit_load_rip_relative(code, value(top)), instruction.constant });
+			emit_register_operation(code, XORPS, dx(top), dx(top)); // a constant does not change with x or y
+			emit_register_operation(code, XORPS, dy(top), dy(top));
+			break;
+		case OpCode::PushX:
+			top++;
+			emit_load_indexed(code, value(top), RDI);
+			constants.push_back({ emit_load_rip_relative(code, dx(top)), 1.f });
+			emit_register_operation(code, XORPS, dy(top), dy(top));
+			break;
+		case OpCode::PushY:
+			top++;
+			emit_load_indexed(code, value(top), RSI);
+			emit_register_operation(code, XORPS, dx(top), dx(top));
+			constants.push_back({ emit_load_rip_relative(code, dy(top)), 1.f });
+			break;
+		case OpCode::Add:
+		case OpCode::Subtract:
+		{
+			const SseOpcode opcode = instruction.opCode == OpCode::Add ? ADDPS : SUBPS;
+			emit_register_operation(code, opcode, value(a), value(b));
+			emit_register_operation(code, opcode, dx(a), dx(b));
+			emit_register_operation(code, opcode, dy(a), dy(b));
+			top--;
+			break;
+		}
+		case OpCode::Multiply: // (a, a') * (b, b') = (ab, a'b + ab'), b's derivative registers are reused as scratch
+			emit_register_operation(code, MULPS, dx(a), value(b));
+			emit_register_operation(code, MULPS, dx(b), value(a));
+			emit_register_operation(code, ADDPS, dx(a), dx(b));
+			emit_register_operation(code, MULPS, dy(a), value(b));
+			emit_register_operation(code, MULPS, dy(b), value(a));
+			emit_register_operation(code, ADDPS, dy(a), dy(b));
+			emit_register_operation(code, MULPS, value(a), value(b));
+			top--;
+			break;
+		case OpCode::Divide: // (a, a') / (b, b') = (q, (a' - qb') / b)
+			emit_register_operation(code, DIVPS, value(a), value(b));
+			emit_register_operation(code, MULPS, dx(b), value(a));
+			emit_register_operation(code, SUBPS, dx(a), dx(b));
+			emit_register_operation(code, DIVPS, dx(a), value(b));
+			emit_register_operation(code, MULPS, dy(b), value(a));
+			emit_register_operation(code, SUBPS, dy(a), dy(b));
+			emit_register_operation(code, DIVPS, dy(a), value(b));
+			top--;
+			break;
+		case OpCode::Power: // (a, a') ^ n = (a^n, n a^(n - 1) a')
+		{
+			const Instruction& exponentInstruction = instructions[i - 1];
+			if (exponentInstruction.opCode != OpCode::PushConstant || !is_small_integer(exponentInstruction.constant, maxIntegerPower))
+			{
+				return false;
+			}
+
+			// the exponent was never loaded, so all three of its registers are free
+			emit_dual_integer_power(code, constants, a, b, (int)exponentInstruction.constant);
+			top--;
+			break;
+		}
+		case OpCode::IntegerPower:
+			if (top + 1 >= registerCount / 3) return false; // the working values need a free slot
+			emit_dual_integer_power(code, constants, top, top + 1, instruction.operand);
+			break;
+		case OpCode::PushRowValue: // a row value never depends on y
+			top++;
+			emit_load_displaced(code, value(top), R10, row_value_offset(instruction.operand));
+			emit_load_displaced(code, dx(top), R10, row_derivative_offset(instruction.operand));
+			emit_register_operation(code, XORPS, dy(top), dy(top));
+			break;
+		}
+	}
+
+	emit_store_indexed(code, value(0), RDX);
+	emit_store_indexed(code, dx(0), R8);
+	emit_store_indexed(code, dy(0), R9);
+	emit_loop_end(code, loopStart, exitJumpPosition);
+	emit_constant_pool(code, constants);
+
+	return true;
+}
+
+void ExpressionJit::make_executable(const std::vector<unsigned char>& code, const std::vector<unsigned char>& gradientCode)
+{
+#ifdef EXPRESSION_JIT_AVAILABLE
+	if (code.empty() && gradientCode.empty()) return;
+
+	// the gradient function starts on a fresh 16 byte boundary, its constant pool is addressed relative to itself so it can be moved freely
+	const size_t gradientOffset = (code.size() + 15) & ~(size_t)15;
+	const size_t totalSize = gradientOffset + gradientCode.size();
+
+	// The page is written while it is only writable, then switched to only executable, so it is never both at once
+	void* memory = mmap(nullptr, totalSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) return; // the interpreter will be used
+
+	unsigned char* bytes = static_cast<unsigned char*>(memory);
+	std::memset(bytes, 0xCC, totalSize);
+	std::memcpy(bytes, code.data(), code.size());
+	std::memcpy(bytes + gradientOffset, gradientCode.data(), gradientCode.size());
+
+	if (mprotect(memory, totalSize, PROT_READ | PROT_EXEC) != 0)
+	{
+		munmap(memory, totalSize);
+		return;
+	}
+
+	mExecutableMemory_ = memory;
+	mExecutableSize_ = totalSize;
+	if (!code.empty()) mFunction_ = reinterpret_cast<CompiledFunction>(bytes);
+	if (!gradientCode.empty()) mGradientFunction_ = reinterpret_cast<GradientFunction>(bytes + gradientOffset);
+#else
+	(void)code;
+	(void)gradientCode;
+#endif
+}
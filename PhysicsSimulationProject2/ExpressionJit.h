@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+#include "ExpressionProgram.h"
+
+/**
+ * \brief Translates an ExpressionProgram into native x86-64 machine code, so that sampling does not pay for decoding instructions.
+ * The generated code evaluates four points per iteration using SSE, keeping the whole expression stack in xmm registers.
+ * When the JIT is not available on the platform, or the program uses something it cannot translate, every call falls back to
+ * the SIMD interpreter in ExpressionProgram, so callers never need to check which path was taken
+ */
+class ExpressionJit
+{
+public:
+	// signature of the generated code, count must be a multiple of four. rowValues is only read by programs with row programs
+	typedef void (*CompiledFunction)(const float* x, const float* y, float* output, long long count, const ExpressionProgram::RowValues* rowValues);
+	typedef void (*GradientFunction)(const float* x, const float* y, float* output, long long count, float* dzdx, float* dzdy, const ExpressionProgram::RowValues* rowValues);
+
+	explicit ExpressionJit(const ExpressionProgram& program);
+	~ExpressionJit();
+	ExpressionJit(const ExpressionJit&) = delete;
+	ExpressionJit(ExpressionJit&&) = delete;
+	ExpressionJit& operator=(const ExpressionJit&) = delete;
+	ExpressionJit& operator=(ExpressionJit&&) = delete;
+
+	static bool is_supported(); // true if native code can be generated on this platform at all
+
+	bool is_compiled() const; // true if native code was generated for this program, false if the interpreter is being used
+	bool is_gradient_compiled() const; // the same, for evaluate_batch_with_gradient
+	const ExpressionProgram& get_program() const;
+
+	void prepare_row(float x, ExpressionProgram::RowValues* rowValues) const; // same contract as ExpressionProgram::prepare_row
+
+	// Same contracts as ExpressionProgram, a program with row programs only runs natively when rowValues is given
+	void evaluate_batch(const float* x, const float* y, float* output, int count, const ExpressionProgram::RowValues* rowValues = nullptr) const;
+	void evaluate_batch_with_gradient(const float* x, const float* y, float* output, float* dzdx, float* dzdy, int count, const ExpressionProgram::RowValues* rowValues = nullptr) const;
+
+private:
+	static constexpr int registerCount = 16; // xmm0 - xmm15, the expression stack must fit inside these, a third as many slots when gradients are included
+	static constexpr int maxIntegerPower = 64; // larger constant powers are left to the interpreter
+
+	bool generate_code(std::vector<unsigned char>& code) const; // returns false if the program cannot be translated
+	bool generate_gradient_code(std::vector<unsigned char>& code) const;
+	void make_executable(const std::vector<unsigned char>& code, const std::vector<unsigned char>& gradientCode); // either may be empty
+
+	ExpressionProgram mProgram_;
+	void* mExecutableMemory_;
+	size_t mExecutableSize_;
+	CompiledFunction mFunction_;
+	GradientFunction mGradientFunction_;
+};
@@ -0,0 +1,394 @@
+#include "ExpressionOptimiser.h"
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+namespace
+{
+	bool is_commutative(OpCode opCode)
+	{
+		return opCode == OpCode::Add || opCode == OpCode::Multiply;
+	}
+
+	// The same arithmetic as the interpreter, so a folded constant is exactly the value that would have been calculated for every sample
+	float apply_operation(OpCode opCode, float a, float b)
+	{
+		switch (opCode)
+		{
+		case OpCode::Add:
+			return a + b;
+		case OpCode::Subtract:
+			return a - b;
+		case OpCode::Multiply:
+			return a * b;
+		case OpCode::Divide:
+			return a / b;
+		default:
+			return std::pow(a, b);
+		}
+	}
+}
+
+ExpressionOptimiser::ExpressionOptimiser(const ExpressionProgram& program) :
+	mRoot_(-1)
+{
+	std::vector<int> stack; // the node that pushed each value on the program's stack
+
+	for (const Instruction& instruction : program.get_instructions())
+	{
+		switch (instruction.opCode)
+		{
+		case OpCode::PushConstant:
+		case OpCode::PushX:
+		case OpCode::PushY:
+			stack.push_back(add_leaf(instruction));
+			break;
+		case OpCode::IntegerPower:
+			stack.back() = add_operation(instruction, stack.back(), -1);
+			break;
+		case OpCode::PushRowValue:
+			assert(false); // programs with row programs have already been optimised
+			break;
+		default:
+		{
+			const int right = stack.back();
+			stack.pop_back();
+			stack.back() = add_operation(instruction, stack.back(), right);
+			break;
+		}
+		}
+	}
+
+	assert(stack.size() == 1);
+	mRoot_ = stack.back();
+}
+
+ExpressionProgram ExpressionOptimiser::optimise(const ExpressionProgram& program, bool hoistRowInvariants, OptimiserStatistics* statistics)
+{
+	if (program.is_empty()) return program;
+
+	assert(program.get_row_programs().empty());
+
+	ExpressionOptimiser optimiser(program);
+
+	auto run_pass = [&](const char* name, int (ExpressionOptimiser::*pass)(int))
+	{
+		const int instructionsBefore = optimiser.count_instructions(optimiser.mRoot_);
+		optimiser.mRoot_ = (optimiser.*pass)(optimiser.mRoot_);
+
+		if (statistics != nullptr) statistics->passes.push_back({ name, instructionsBefore, optimiser.count_instructions(optimiser.mRoot_) });
+	};
+
+	if (statistics != nullptr) statistics->passes.clear();
+
+	run_pass("constant folding", &ExpressionOptimiser::fold_constants);
+	run_pass("identities", &ExpressionOptimiser::apply_identities);
+	run_pass("strength reduction", &ExpressionOptimiser::reduce_strength);
+
+	std::vector<ExpressionProgram> rowPrograms;
+	int instructionsPerRow = 0;
+
+	if (hoistRowInvariants)
+	{
+		const int instructionsBefore = optimiser.count_instructions(optimiser.mRoot_);
+		optimiser.mRoot_ = optimiser.hoist_row_invariants(optimiser.mRoot_, rowPrograms);
+
+		for (const ExpressionProgram& rowProgram : rowPrograms) instructionsPerRow += (int)rowProgram.get_instructions().size();
+
+		// the hoisted instructions still run, just once per row, so they are counted as part of the pass's output
+		if (statistics != nullptr) statistics->passes.push_back({ "row hoisting", instructionsBefore, optimiser.count_instructions(optimiser.mRoot_) + instructionsPerRow });
+	}
+
+	std::vector<Instruction> instructions;
+	instructions.reserve(optimiser.count_instructions(optimiser.mRoot_));
+	optimiser.emit(optimiser.mRoot_, instructions);
+
+	if (statistics != nullptr)
+	{
+		statistics->instructionsPerSample = (int)instructions.size();
+		statistics->instructionsPerRow = instructionsPerRow;
+	}
+
+	return ExpressionProgram::from_instructions(std::move(instructions), std::move(rowPrograms));
+}
+
+bool ExpressionOptimiser::separate(const ExpressionProgram& program, SeparableProgram* separable)
+{
+	if (program.is_empty()) return false;
+
+	// folding constants and removing identities first means terms like 0 * x * y no longer get in the way
+	ExpressionOptimiser optimiser(optimise(program, false));
+
+	const OpCode rootOpCode = optimiser.mNodes_[optimiser.mRoot_].instruction.opCode;
+	const bool isProduct = rootOpCode == OpCode::Multiply || rootOpCode == OpCode::Divide;
+
+	// any other expression is treated as a sum with a single term, so expressions of only x or only y are also separable
+	std::vector<Term> terms;
+	optimiser.collect_terms(optimiser.mRoot_, false, isProduct, terms);
+
+	std::vector<Term> xTerms;
+	std::vector<Term> yTerms;
+
+	for (const Term& term : terms)
+	{
+		const Node& node = optimiser.mNodes_[term.node];
+		if (node.usesX && node.usesY) return false;
+
+		(node.usesY ? yTerms : xTerms).push_back(term); // constants are calculated along with the x terms, once per row
+	}
+
+	separable->combine = isProduct ? OpCode::Multiply : OpCode::Add;
+	separable->xPart = optimiser.combine_terms(xTerms, isProduct);
+	separable->yPart = optimiser.combine_terms(yTerms, isProduct);
+
+	return true;
+}
+
+void ExpressionOptimiser::collect_terms(int node, bool isInverted, bool isProduct, std::vector<Term>& terms) const
+{
+	const Node& current = mNodes_[node];
+
+	const OpCode combine = isProduct ? OpCode::Multiply : OpCode::Add;
+	const OpCode inverse = isProduct ? OpCode::Divide : OpCode::Subtract;
+
+	if (current.instruction.opCode == combine || current.instruction.opCode == inverse)
+	{
+		collect_terms(current.left, isInverted, isProduct, terms);
+		collect_terms(current.right, isInverted != (current.instruction.opCode == inverse), isProduct, terms);
+		return;
+	}
+
+	terms.push_back({ node, isInverted });
+}
+
+ExpressionProgram ExpressionOptimiser::combine_terms(const std::vector<Term>& terms, bool isProduct)
+{
+	const float identity = isProduct ? 1.f : 0.f;
+
+	int result = -1;
+	for (const Term& term : terms)
+	{
+		if (result == -1 && !term.isInverted)
+		{
+			result = term.node;
+			continue;
+		}
+
+		// an inverted first term is applied to the identity, e.g. -x is 0 - x
+		const int left = result == -1 ? add_constant(identity) : result;
+
+		OpCode opCode = isProduct ? OpCode::Multiply : OpCode::Add;
+		if (term.isInverted) opCode = isProduct ? OpCode::Divide : OpCode::Subtract;
+
+		result = add_operation({ opCode, 0.f, 0 }, left, term.node);
+	}
+
+	if (result == -1) result = add_constant(identity); // a part with no terms leaves the other part unchanged
+
+	std::vector<Instruction> instructions;
+	emit(result, instructions);
+
+	return ExpressionProgram::from_instructions(std::move(instructions), {});
+}
+
+int ExpressionOptimiser::add_leaf(const Instruction& instruction)
+{
+	Node node = { instruction, -1, -1, false, false, false };
+	node.usesX = instruction.opCode == OpCode::PushX;
+	node.usesY = instruction.opCode == OpCode::PushY;
+	node.mayBeNonFinite = instruction.opCode == OpCode::PushConstant && !std::isfinite(instruction.constant); // e.g. a literal too large for a float
+
+	mNodes_.push_back(node);
+	return (int)mNodes_.size() - 1;
+}
+
+int ExpressionOptimiser::add_operation(const Instruction& instruction, int left, int right)
+{
+	Node node = { instruction, left, right, mNodes_[left].usesX, mNodes_[left].usesY, mNodes_[left].mayBeNonFinite };
+
+	if (right != -1)
+	{
+		node.usesX |= mNodes_[right].usesX;
+		node.usesY |= mNodes_[right].usesY;
+		node.mayBeNonFinite |= mNodes_[right].mayBeNonFinite;
+	}
+	if (instruction.opCode == OpCode::Divide || instruction.opCode == OpCode::Power || (instruction.opCode == OpCode::IntegerPower && instruction.operand < 0))
+	{
+		node.mayBeNonFinite = true;
+	}
+
+	// products of x and y overflow to inf once the graph is zoomed out far enough, e.g. x^16 past |x| = 256
+	const bool isProduct = instruction.opCode == OpCode::Multiply || instruction.opCode == OpCode::IntegerPower;
+	if (isProduct && (node.usesX || node.usesY))
+	{
+		node.mayBeNonFinite = true;
+	}
+
+	mNodes_.push_back(node);
+	return (int)mNodes_.size() - 1;
+}
+
+int ExpressionOptimiser::add_constant(float value)
+{
+	return add_leaf({ OpCode::PushConstant, value, 0 });
+}
+
+bool ExpressionOptimiser::is_constant(int node, float value) const
+{
+	return mNodes_[node].instruction.opCode == OpCode::PushConstant && mNodes_[node].instruction.constant == value;
+}
+
+int ExpressionOptimiser::fold_constants(int node)
+{
+	const Node current = mNodes_[node]; // copied, adding nodes may move the array
+	if (current.left == -1) return node;
+
+	const int left = fold_constants(current.left);
+	const bool isLeftConstant = mNodes_[left].instruction.opCode == OpCode::PushConstant;
+
+	if (current.right == -1) // OpCode::IntegerPower
+	{
+		if (isLeftConstant)
+		{
+			return add_constant(ExpressionProgram::from_instructions({ mNodes_[left].instruction, current.instruction }, {}).evaluate(0.f, 0.f));
+		}
+		return add_operation(current.instruction, left, -1);
+	}
+
+	const int right = fold_constants(current.right);
+
+	if (isLeftConstant && mNodes_[right].instruction.opCode == OpCode::PushConstant)
+	{
+		return add_constant(apply_operation(current.instruction.opCode, mNodes_[left].instruction.constant, mNodes_[right].instruction.constant));
+	}
+
+	return add_operation(current.instruction, left, right);
+}
+
+int ExpressionOptimiser::apply_identities(int node)
+{
+	const Node current = mNodes_[node];
+	if (current.left == -1) return node;
+
+	const int left = apply_identities(current.left);
+	const int right = current.right == -1 ? -1 : apply_identities(current.right);
+
+	// removing an identity can leave an operation with only constant operands, e.g. (0 * x) + 2
+	const int folded = fold_constants(add_operation(current.instruction, left, right));
+	if (right == -1 || mNodes_[folded].instruction.opCode == OpCode::PushConstant) return folded;
+
+	switch (current.instruction.opCode)
+	{
+	case OpCode::Add:
+		if (is_constant(right, 0.f)) return left;
+		if (is_constant(left, 0.f)) return right;
+		break;
+	case OpCode::Subtract:
+		if (is_constant(right, 0.f)) return left;
+		break;
+	case OpCode::Multiply:
+		if (is_constant(right, 1.f)) return left;
+		if (is_constant(left, 1.f)) return right;
+		// 0 * inf is nan, so zero only absorbs operands that are always finite (up to the sign of the zero)
+		if (is_constant(left, 0.f) && !mNodes_[right].mayBeNonFinite) return add_constant(0.f);
+		if (is_constant(right, 0.f) && !mNodes_[left].mayBeNonFinite) return add_constant(0.f);
+		break;
+	case OpCode::Divide:
+		if (is_constant(right, 1.f)) return left;
+		break;
+	case OpCode::Power:
+		if (is_constant(right, 1.f)) return left;
+		if (is_constant(right, 0.f)) return add_constant(1.f); // pow(x, 0) is 1 for every x, even nan
+		break;
+	default:
+		break;
+	}
+
+	return folded;
+}
+
+int ExpressionOptimiser::reduce_strength(int node)
+{
+	const Node current = mNodes_[node];
+	if (current.left == -1) return node;
+
+	const int left = reduce_strength(current.left);
+	if (current.right == -1) return add_operation(current.instruction, left, -1);
+
+	const int right = reduce_strength(current.right);
+
+	const Instruction& exponent = mNodes_[right].instruction;
+	if (current.instruction.opCode == OpCode::Power && exponent.opCode == OpCode::PushConstant &&
+		exponent.constant == std::floor(exponent.constant) && std::fabs(exponent.constant) <= maxStrengthReducedPower)
+	{
+		return add_operation({ OpCode::IntegerPower, 0.f, (int)exponent.constant }, left, -1);
+	}
+
+	return add_operation(current.instruction, left, right);
+}
+
+int ExpressionOptimiser::hoist_row_invariants(int node, std::vector<ExpressionProgram>& rowPrograms)
+{
+	const Node current = mNodes_[node];
+	if (current.left == -1) return node; // pushing a single value is as cheap as pushing a row value
+
+	// this is the largest subtree around here that does not change along a row, so it is calculated once per row instead
+	if (current.usesX && !current.usesY && (int)rowPrograms.size() < ExpressionProgram::maxRowValues)
+	{
+		std::vector<Instruction> instructions;
+		emit(node, instructions);
+		rowPrograms.push_back(ExpressionProgram::from_instructions(std::move(instructions), {}));
+
+		return add_leaf({ OpCode::PushRowValue, 0.f, (int)rowPrograms.size() - 1 });
+	}
+
+	const int left = hoist_row_invariants(current.left, rowPrograms);
+	const int right = current.right == -1 ? -1 : hoist_row_invariants(current.right, rowPrograms);
+
+	return add_operation(current.instruction, left, right);
+}
+
+int ExpressionOptimiser::count_instructions(int node) const
+{
+	const Node& current = mNodes_[node];
+
+	int count = 1;
+	if (current.left != -1) count += count_instructions(current.left);
+	if (current.right != -1) count += count_instructions(current.right);
+	return count;
+}
+
+int ExpressionOptimiser::stack_depth(int node) const
+{
+	const Node& current = mNodes_[node];
+	if (current.left == -1) return 1;
+
+	const int leftDepth = stack_depth(current.left);
+	if (current.right == -1) return leftDepth;
+
+	const int rightDepth = stack_depth(current.right);
+
+	// the result of the first operand stays on the stack while the second is calculated, commutative operands are emitted deepest first
+	if (is_commutative(current.instruction.opCode) && leftDepth != rightDepth) return std::max(leftDepth, rightDepth);
+	return std::max(leftDepth, rightDepth + 1);
+}
+
+void ExpressionOptimiser::emit(int node, std::vector<Instruction>& instructions) const
+{
+	const Node& current = mNodes_[node];
+
+	if (current.right != -1)
+	{
+		// a + b and a * b give exactly the same result as b + a and b * a, so the order that needs the fewest stack slots (and JIT registers) is used
+		const bool isRightFirst = is_commutative(current.instruction.opCode) && stack_depth(current.right) > stack_depth(current.left);
+
+		emit(isRightFirst ? current.right : current.left, instructions);
+		emit(isRightFirst ? current.left : current.right, instructions);
+	}
+	else if (current.left != -1)
+	{
+		emit(current.left, instructions);
+	}
+
+	instructions.push_back(current.instruction);
+}
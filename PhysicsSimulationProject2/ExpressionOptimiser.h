@@ -0,0 +1,101 @@
+#pragma once
+#include <vector>
+
+#include "ExpressionProgram.h"
+
+// How many instructions a single pass of the optimiser removed
+struct OptimiserPassStatistics
+{
+	const char* name;
+	int instructionsBefore;
+	int instructionsAfter;
+};
+
+struct OptimiserStatistics
+{
+	std::vector<OptimiserPassStatistics> passes; // in the order the passes were run
+	int instructionsPerSample; // the instructions left in the program itself, which are run for every sample
+	int instructionsPerRow; // the instructions moved into row programs, which are run once for every row of samples
+};
+
+/**
+ * \brief An expression split into a part that only depends on x and a part that only depends on y, z = xPart(x) op yPart(y).
+ * Over a grid, xPart only needs calculating once per row and yPart once per column, so the work left at every point is a single operation
+ */
+struct SeparableProgram
+{
+	OpCode combine; // OpCode::Add or OpCode::Multiply
+	ExpressionProgram xPart; // never reads y
+	ExpressionProgram yPart; // never reads x
+};
+
+/**
+ * \brief Rewrites a compiled program into an equivalent one that does less work for every sample. The passes are run in order:
+ * constant folding, algebraic identities (x * 1, x + 0, x ^ 1 ...), strength reduction of small integer powers into multiplications,
+ * and, when asked for, hoisting subexpressions that only depend on x into row programs that are calculated once per row.
+ * Apart from integer powers, which round like the JIT's, every rewrite gives exactly the same result as the original program
+ */
+class ExpressionOptimiser
+{
+public:
+	static constexpr int maxStrengthReducedPower = 16; // larger integer exponents are left to std::pow
+
+	/**
+	 * \brief Optimises a program compiled by ExpressionProgram::compile
+	 * \param program - the program to optimise, it must not already have row programs
+	 * \param hoistRowInvariants - if true, subexpressions that only depend on x are hoisted. Only worth it when whole rows sharing an x value are sampled
+	 * \param statistics - optional, filled with the number of instructions before and after every pass
+	 * \return the optimised program, empty if the program was empty
+	 */
+	static ExpressionProgram optimise(const ExpressionProgram& program, bool hoistRowInvariants, OptimiserStatistics* statistics = nullptr);
+
+	/**
+	 * \brief Detects expressions that are sums or products of terms that each depend on only one of x and y, e.g. x^2 + y^2, x * y or x^3 - 3 * y.
+	 * The terms are regrouped, so the result may differ from the original program by rounding
+	 * \param program - the program to split, it must not already have row programs
+	 * \param separable - set to the split program if the expression is separable
+	 * \return false if the expression is empty or has a term that depends on both x and y
+	 */
+	static bool separate(const ExpressionProgram& program, SeparableProgram* separable);
+
+private:
+	// The program is rewritten as a tree, where every node is an instruction and its operands are the nodes that pushed them
+	struct Node
+	{
+		Instruction instruction;
+		int left; // the only operand of OpCode::IntegerPower, -1 for instructions that push a value
+		int right; // -1 unless the instruction is a binary operator
+		bool usesX;
+		bool usesY;
+		bool mayBeNonFinite; // true if the subtree may produce inf or nan for finite x and y, by dividing, taking a power, overflowing a product or holding an inf constant
+	};
+
+	explicit ExpressionOptimiser(const ExpressionProgram& program);
+
+	int add_leaf(const Instruction& instruction);
+	int add_operation(const Instruction& instruction, int left, int right);
+	int add_constant(float value);
+	bool is_constant(int node, float value) const;
+
+	int fold_constants(int node);
+	int apply_identities(int node);
+	int reduce_strength(int node);
+	int hoist_row_invariants(int node, std::vector<ExpressionProgram>& rowPrograms);
+
+	// A term of a sum or product, inverted terms are subtracted from a sum or divide a product
+	struct Term
+	{
+		int node;
+		bool isInverted;
+	};
+
+	void collect_terms(int node, bool isInverted, bool isProduct, std::vector<Term>& terms) const;
+	ExpressionProgram combine_terms(const std::vector<Term>& terms, bool isProduct); // emits the terms as a single sum or product
+
+	int count_instructions(int node) const;
+	int stack_depth(int node) const; // the stack depth needed to evaluate the subtree when it is emitted by emit
+	void emit(int node, std::vector<Instruction>& instructions) const;
+
+	std::vector<Node> mNodes_;
+	int mRoot_;
+};
@@ -0,0 +1,636 @@
+#include "ExpressionProgram.h"
+#include <cstdlib>
+#include <algorithm>
+
+// GLM only reports the SSE/AVX level it was compiled with when intrinsics are enabled.
+// Nothing from GLM's maths types is used in this file, so enabling them here does not change any other translation unit
+#define GLM_FORCE_INTRINSICS
+#include "glm/simd/platform.h"
+
+namespace
+{
+	// A lane is the widest group of floats that a single SIMD instruction can operate on
+#if GLM_ARCH & GLM_ARCH_AVX2_BIT
+	constexpr int laneWidth = 8;
+	typedef __m256 Lane;
+	inline Lane load_lane(const float* source) { return _mm256_load_ps(source); }
+	inline void store_lane(float* destination, Lane value) { _mm256_store_ps(destination, value); }
+	inline Lane add_lanes(Lane a, Lane b) { return _mm256_add_ps(a, b); }
+	inline Lane subtract_lanes(Lane a, Lane b) { return _mm256_sub_ps(a, b); }
+	inline Lane multiply_lanes(Lane a, Lane b) { return _mm256_mul_ps(a, b); }
+	inline Lane divide_lanes(Lane a, Lane b) { return _mm256_div_ps(a, b); }
+	inline Lane broadcast_lane(float value) { return _mm256_set1_ps(value); }
+#elif GLM_ARCH & GLM_ARCH_SSE2_BIT
+	constexpr int laneWidth = 4;
+	typedef __m128 Lane;
+	inline Lane load_lane(const float* source) { return _mm_load_ps(source); }
+	inline void store_lane(float* destination, Lane value) { _mm_store_ps(destination, value); }
+	inline Lane add_lanes(Lane a, Lane b) { return _mm_add_ps(a, b); }
+	inline Lane subtract_lanes(Lane a, Lane b) { return _mm_sub_ps(a, b); }
+	inline Lane multiply_lanes(Lane a, Lane b) { return _mm_mul_ps(a, b); }
+	inline Lane divide_lanes(Lane a, Lane b) { return _mm_div_ps(a, b); }
+	inline Lane broadcast_lane(float value) { return _mm_set1_ps(value); }
+#else // scalar fallback, the compiler is still free to vectorise the loops below
+	constexpr int laneWidth = 1;
+	typedef float Lane;
+	inline Lane load_lane(const float* source) { return *source; }
+	inline void store_lane(float* destination, Lane value) { *destination = value; }
+	inline Lane add_lanes(Lane a, Lane b) { return a + b; }
+	inline Lane subtract_lanes(Lane a, Lane b) { return a - b; }
+	inline Lane multiply_lanes(Lane a, Lane b) { return a * b; }
+	inline Lane divide_lanes(Lane a, Lane b) { return a / b; }
+	inline Lane broadcast_lane(float value) { return value; }
+#endif
+
+	static_assert(ExpressionProgram::batchSize % laneWidth == 0, "a batch must be made up of whole lanes");
+
+	// Applies operation to every lane of a batch, the result overwrites the left operand as it would on a normal stack
+	template <Lane (*operation)(Lane, Lane)>
+	inline void apply_to_batch(float* left, const float* right)
+	{
+		for (int i = 0; i < ExpressionProgram::batchSize; i += laneWidth)
+		{
+			store_lane(left + i, operation(load_lane(left + i), load_lane(right + i)));
+		}
+	}
+
+	// base^exponent by repeated squaring, working from the most significant bit down in the same order as the JIT so both give identical results
+	template <typename Value>
+	inline Value integer_power(Value base, int exponent, Value (*multiply)(Value, Value), Value (*divide)(Value, Value), Value one)
+	{
+		if (exponent == 0) return one;
+
+		const int magnitude = exponent < 0 ? -exponent : exponent;
+
+		int highestBit = 0;
+		while ((magnitude >> (highestBit + 1)) != 0) highestBit++;
+
+		Value result = base;
+		for (int bit = highestBit - 1; bit >= 0; bit--)
+		{
+			result = multiply(result, result);
+			if ((magnitude >> bit) & 1) result = multiply(result, base);
+		}
+
+		return exponent < 0 ? divide(one, result) : result; // x^-n = 1 / x^n
+	}
+
+	inline float multiply_floats(float a, float b) { return a * b; }
+	inline float divide_floats(float a, float b) { return a / b; }
+
+	inline float integer_power(float base, int exponent)
+	{
+		return integer_power<float>(base, exponent, multiply_floats, divide_floats, 1.f);
+	}
+
+	void integer_power_batch(float* values, int exponent)
+	{
+		for (int i = 0; i < ExpressionProgram::batchSize; i += laneWidth)
+		{
+			store_lane(values + i, integer_power<Lane>(load_lane(values + i), exponent, multiply_lanes, divide_lanes, broadcast_lane(1.f)));
+		}
+	}
+
+	typedef ExpressionProgram::DualBatch DualBatch;
+
+	void set_dual_batch(DualBatch& entry, const float* value, float dx, float dy)
+	{
+		std::copy(value, value + ExpressionProgram::batchSize, entry.value);
+		std::fill(entry.dx, entry.dx + ExpressionProgram::batchSize, dx);
+		std::fill(entry.dy, entry.dy + ExpressionProgram::batchSize, dy);
+	}
+
+	// (a, a') * (b, b') = (ab, a'b + ab')
+	void multiply_dual_batches(DualBatch& left, const DualBatch& right)
+	{
+		for (int i = 0; i < ExpressionProgram::batchSize; i += laneWidth)
+		{
+			const Lane a = load_lane(left.value + i);
+			const Lane b = load_lane(right.value + i);
+
+			store_lane(left.dx + i, add_lanes(multiply_lanes(load_lane(left.dx + i), b), multiply_lanes(a, load_lane(right.dx + i))));
+			store_lane(left.dy + i, add_lanes(multiply_lanes(load_lane(left.dy + i), b), multiply_lanes(a, load_lane(right.dy + i))));
+			store_lane(left.value + i, multiply_lanes(a, b));
+		}
+	}
+
+	// (a, a') / (b, b') = (q, (a' - qb') / b) where q = a / b
+	void divide_dual_batches(DualBatch& left, const DualBatch& right)
+	{
+		for (int i = 0; i < ExpressionProgram::batchSize; i += laneWidth)
+		{
+			const Lane b = load_lane(right.value + i);
+			const Lane quotient = divide_lanes(load_lane(left.value + i), b);
+
+			store_lane(left.dx + i, divide_lanes(subtract_lanes(load_lane(left.dx + i), multiply_lanes(quotient, load_lane(right.dx + i))), b));
+			store_lane(left.dy + i, divide_lanes(subtract_lanes(load_lane(left.dy + i), multiply_lanes(quotient, load_lane(right.dy + i))), b));
+			store_lane(left.value + i, quotient);
+		}
+	}
+
+	// (a, a') ^ n = (a^n, n a^(n - 1) a') for a constant integer n
+	void integer_power_dual_batch(DualBatch& entry, int exponent)
+	{
+		for (int i = 0; i < ExpressionProgram::batchSize; i++)
+		{
+			const float derivative = exponent == 0 ? 0.f : exponent * integer_power(entry.value[i], exponent - 1);
+
+			entry.value[i] = integer_power(entry.value[i], exponent);
+			entry.dx[i] *= derivative;
+			entry.dy[i] *= derivative;
+		}
+	}
+
+	// (a, a') ^ (b, b') = (a^b, b a^(b - 1) a' + a^b ln(a) b'), each term is skipped when its derivative is zero so that ln of a negative base is never used
+	void power_dual_batches(DualBatch& left, const DualBatch& right)
+	{
+		for (int i = 0; i < ExpressionProgram::batchSize; i++)
+		{
+			const float a = left.value[i];
+			const float b = right.value[i];
+			const float result = std::pow(a, b);
+
+			float dx = 0.f;
+			float dy = 0.f;
+
+			if (left.dx[i] != 0.f || left.dy[i] != 0.f)
+			{
+				const float baseDerivative = b * std::pow(a, b - 1.f);
+				dx += baseDerivative * left.dx[i];
+				dy += baseDerivative * left.dy[i];
+			}
+			if (right.dx[i] != 0.f || right.dy[i] != 0.f)
+			{
+				const float exponentDerivative = result * std::log(a);
+				dx += exponentDerivative * right.dx[i];
+				dy += exponentDerivative * right.dy[i];
+			}
+
+			left.value[i] = result;
+			left.dx[i] = dx;
+			left.dy[i] = dy;
+		}
+	}
+}
+
+ExpressionProgram::ExpressionProgram() :
+	mStackDepth_(0)
+{
+}
+
+ExpressionProgram ExpressionProgram::compile(const std::vector<Token>& postfixExpression, bool* errorFlag)
+{
+	ExpressionProgram program;
+	program.mInstructions_.reserve(postfixExpression.size()); // every token becomes exactly one instruction
+
+	int currentDepth = 0; // we simulate the stack while compiling, so that invalid postfix is rejected here rather than during sampling
+
+	for (const Token& token : postfixExpression)
+	{
+		Instruction instruction = { OpCode::PushConstant, 0.f, 0 };
+
+		switch (token.kind)
+		{
+		case TokenKind::Number:
+			instruction.constant = token.value;
+			break;
+		case TokenKind::X:
+			instruction.opCode = OpCode::PushX;
+			break;
+		case TokenKind::Y:
+			instruction.opCode = OpCode::PushY;
+			break;
+		case TokenKind::Add:
+			instruction.opCode = OpCode::Add;
+			break;
+		case TokenKind::Subtract:
+			instruction.opCode = OpCode::Subtract;
+			break;
+		case TokenKind::Multiply:
+			instruction.opCode = OpCode::Multiply;
+			break;
+		case TokenKind::Divide:
+			instruction.opCode = OpCode::Divide;
+			break;
+		default:
+			instruction.opCode = OpCode::Power;
+			break;
+		}
+
+		const bool isOperand = token.kind == TokenKind::Number || token.kind == TokenKind::X || token.kind == TokenKind::Y;
+
+		if (isOperand)
+		{
+			currentDepth++;
+			if (currentDepth > maxStackDepth)
+			{
+				*errorFlag = true;
+				return {};
+			}
+		}
+		else
+		{
+			if (currentDepth < 2) // an operator needs two operands
+			{
+				*errorFlag = true;
+				return {};
+			}
+			currentDepth--; // two operands are popped and one result is pushed
+		}
+
+		if (currentDepth > program.mStackDepth_) program.mStackDepth_ = currentDepth;
+
+		program.mInstructions_.push_back(instruction);
+	}
+
+	if (currentDepth != 1 && !program.mInstructions_.empty()) // a valid expression leaves exactly one value on the stack
+	{
+		*errorFlag = true;
+		return {};
+	}
+
+	return program;
+}
+
+ExpressionProgram ExpressionProgram::from_instructions(std::vector<Instruction> instructions, std::vector<ExpressionProgram> rowPrograms)
+{
+	assert(rowPrograms.size() <= maxRowValues);
+
+	ExpressionProgram program;
+	program.mInstructions_ = std::move(instructions);
+	program.mRowPrograms_ = std::move(rowPrograms);
+
+	int currentDepth = 0;
+	for (const Instruction& instruction : program.mInstructions_)
+	{
+		switch (instruction.opCode)
+		{
+		case OpCode::PushConstant:
+		case OpCode::PushX:
+		case OpCode::PushY:
+		case OpCode::PushRowValue:
+			currentDepth++;
+			break;
+		case OpCode::IntegerPower: // replaces the value on top of the stack
+			break;
+		default:
+			currentDepth--;
+			break;
+		}
+
+		assert(currentDepth >= 1 && currentDepth <= maxStackDepth);
+		assert(instruction.opCode != OpCode::PushRowValue || instruction.operand < (int)program.mRowPrograms_.size());
+
+		if (currentDepth > program.mStackDepth_) program.mStackDepth_ = currentDepth;
+	}
+
+	assert(currentDepth == 1 || program.mInstructions_.empty());
+
+	return program;
+}
+
+void ExpressionProgram::prepare_row(float x, RowValues* rowValues) const
+{
+	const float y = 0.f; // row programs never read y
+
+	for (size_t i = 0; i < mRowPrograms_.size(); i++)
+	{
+		float value, dzdx, dzdy;
+		mRowPrograms_[i].evaluate_batch_with_gradient(&x, &y, &value, &dzdx, &dzdy, 1);
+
+		std::fill(rowValues->value[i], rowValues->value[i] + 4, value);
+		std::fill(rowValues->dx[i], rowValues->dx[i] + 4, dzdx);
+	}
+}
+
+float ExpressionProgram::evaluate(float x, float y) const
+{
+	assert(!mInstructions_.empty());
+
+	float stack[maxStackDepth]; // fixed size stack, so no memory is allocated per sample
+	int top = -1; // index of the value on top of the stack
+
+	for (const Instruction& instruction : mInstructions_)
+	{
+		switch (instruction.opCode)
+		{
+		case OpCode::PushConstant:
+			stack[++top] = instruction.constant;
+			break;
+		case OpCode::PushX:
+			stack[++top] = x;
+			break;
+		case OpCode::PushY:
+			stack[++top] = y;
+			break;
+		case OpCode::Add:
+			stack[top - 1] = stack[top - 1] + stack[top];
+			top--;
+			break;
+		case OpCode::Subtract:
+			stack[top - 1] = stack[top - 1] - stack[top];
+			top--;
+			break;
+		case OpCode::Multiply:
+			stack[top - 1] = stack[top - 1] * stack[top];
+			top--;
+			break;
+		case OpCode::Divide:
+			stack[top - 1] = stack[top - 1] / stack[top];
+			top--;
+			break;
+		case OpCode::Power:
+			stack[top - 1] = std::pow(stack[top - 1], stack[top]);
+			top--;
+			break;
+		case OpCode::IntegerPower:
+			stack[top] = integer_power(stack[top], instruction.operand);
+			break;
+		case OpCode::PushRowValue: // a single point gains nothing from hoisting, so the row program is simply run
+			stack[++top] = mRowPrograms_[instruction.operand].evaluate(x, y);
+			break;
+		}
+	}
+
+	return stack[0];
+}
+
+void ExpressionProgram::evaluate_batch(const float* x, const float* y, float* output, int count, const RowValues* rowValues) const
+{
+	assert(!mInstructions_.empty());
+
+	int i = 0;
+	for (; i + batchSize <= count; i += batchSize)
+	{
+		evaluate_full_batch(x + i, y + i, output + i, rowValues);
+	}
+
+	if (i < count) // the final batch is only partially full, so we pad it with copies of the last point
+	{
+		alignas(32) float xPadded[batchSize];
+		alignas(32) float yPadded[batchSize];
+		alignas(32) float outputPadded[batchSize];
+
+		const int remaining = count - i;
+		for (int j = 0; j < batchSize; j++)
+		{
+			xPadded[j] = x[i + std::min(j, remaining - 1)];
+			yPadded[j] = y[i + std::min(j, remaining - 1)];
+		}
+
+		evaluate_full_batch(xPadded, yPadded, outputPadded, rowValues);
+
+		std::copy(outputPadded, outputPadded + remaining, output + i);
+	}
+}
+
+void ExpressionProgram::evaluate_batch_with_gradient(const float* x, const float* y, float* output, float* dzdx, float* dzdy, int count, const RowValues* rowValues) const
+{
+	assert(!mInstructions_.empty());
+
+	int i = 0;
+	for (; i + batchSize <= count; i += batchSize)
+	{
+		evaluate_full_batch_with_gradient(x + i, y + i, output + i, dzdx + i, dzdy + i, rowValues);
+	}
+
+	if (i < count) // padded in the same way as evaluate_batch
+	{
+		alignas(32) float xPadded[batchSize];
+		alignas(32) float yPadded[batchSize];
+		alignas(32) float outputPadded[batchSize];
+		alignas(32) float dzdxPadded[batchSize];
+		alignas(32) float dzdyPadded[batchSize];
+
+		const int remaining = count - i;
+		for (int j = 0; j < batchSize; j++)
+		{
+			xPadded[j] = x[i + std::min(j, remaining - 1)];
+			yPadded[j] = y[i + std::min(j, remaining - 1)];
+		}
+
+		evaluate_full_batch_with_gradient(xPadded, yPadded, outputPadded, dzdxPadded, dzdyPadded, rowValues);
+
+		std::copy(outputPadded, outputPadded + remaining, output + i);
+		std::copy(dzdxPadded, dzdxPadded + remaining, dzdx + i);
+		std::copy(dzdyPadded, dzdyPadded + remaining, dzdy + i);
+	}
+}
+
+void ExpressionProgram::evaluate_full_batch(const float* x, const float* y, float* output, const RowValues* rowValues) const
+{
+	// Each stack entry holds a whole batch of values instead of a single value
+	alignas(32) float stack[maxStackDepth][batchSize];
+	int top = -1;
+
+	for (const Instruction& instruction : mInstructions_)
+	{
+		switch (instruction.opCode)
+		{
+		case OpCode::PushConstant:
+			top++;
+			std::fill(stack[top], stack[top] + batchSize, instruction.constant);
+			break;
+		case OpCode::PushX:
+			top++;
+			std::copy(x, x + batchSize, stack[top]);
+			break;
+		case OpCode::PushY:
+			top++;
+			std::copy(y, y + batchSize, stack[top]);
+			break;
+		case OpCode::Add:
+			apply_to_batch<add_lanes>(stack[top - 1], stack[top]);
+			top--;
+			break;
+		case OpCode::Subtract:
+			apply_to_batch<subtract_lanes>(stack[top - 1], stack[top]);
+			top--;
+			break;
+		case OpCode::Multiply:
+			apply_to_batch<multiply_lanes>(stack[top - 1], stack[top]);
+			top--;
+			break;
+		case OpCode::Divide:
+			apply_to_batch<divide_lanes>(stack[top - 1], stack[top]);
+			top--;
+			break;
+		case OpCode::Power: // there is no SIMD instruction for pow, so this is done one value at a time
+			for (int i = 0; i < batchSize; i++)
+			{
+				stack[top - 1][i] = std::pow(stack[top - 1][i], stack[top][i]);
+			}
+			top--;
+			break;
+		case OpCode::IntegerPower:
+			integer_power_batch(stack[top], instruction.operand);
+			break;
+		case OpCode::PushRowValue:
+			top++;
+			if (rowValues != nullptr)
+			{
+				std::fill(stack[top], stack[top] + batchSize, rowValues->value[instruction.operand][0]);
+			}
+			else // the points may not share an x value, so the row program is run for every point
+			{
+				mRowPrograms_[instruction.operand].evaluate_full_batch(x, y, stack[top], nullptr);
+			}
+			break;
+		}
+	}
+
+	std::copy(stack[0], stack[0] + batchSize, output);
+}
+
+void ExpressionProgram::evaluate_full_batch_with_gradient(const float* x, const float* y, float* output, float* dzdx, float* dzdy, const RowValues* rowValues) const
+{
+	DualBatch stack[maxStackDepth];
+	int top = -1;
+
+	for (const Instruction& instruction : mInstructions_)
+	{
+		switch (instruction.opCode)
+		{
+		case OpCode::PushConstant:
+			top++;
+			std::fill(stack[top].value, stack[top].value + batchSize, instruction.constant);
+			std::fill(stack[top].dx, stack[top].dx + batchSize, 0.f);
+			std::fill(stack[top].dy, stack[top].dy + batchSize, 0.f);
+			break;
+		case OpCode::PushX: // dx/dx = 1, dx/dy = 0
+			set_dual_batch(stack[++top], x, 1.f, 0.f);
+			break;
+		case OpCode::PushY:
+			set_dual_batch(stack[++top], y, 0.f, 1.f);
+			break;
+		case OpCode::IntegerPower: // the only operand is the top of the stack, so the unused right operand is the top too
+			apply_dual_operation(instruction, stack[top], stack[top]);
+			break;
+		default:
+			apply_dual_operation(instruction, stack[top - 1], stack[top]);
+			top--;
+			break;
+		case OpCode::PushRowValue:
+			top++;
+			if (rowValues != nullptr)
+			{
+				std::fill(stack[top].value, stack[top].value + batchSize, rowValues->value[instruction.operand][0]);
+				std::fill(stack[top].dx, stack[top].dx + batchSize, rowValues->dx[instruction.operand][0]);
+				std::fill(stack[top].dy, stack[top].dy + batchSize, 0.f);
+			}
+			else
+			{
+				mRowPrograms_[instruction.operand].evaluate_full_batch_with_gradient(x, y, stack[top].value, stack[top].dx, stack[top].dy, nullptr);
+			}
+			break;
+		}
+	}
+
+	std::copy(stack[0].value, stack[0].value + batchSize, output);
+	std::copy(stack[0].dx, stack[0].dx + batchSize, dzdx);
+	std::copy(stack[0].dy, stack[0].dy + batchSize, dzdy);
+}
+
+void ExpressionProgram::apply_dual_operation(const Instruction& instruction, DualBatch& left, const DualBatch& right)
+{
+	switch (instruction.opCode)
+	{
+	case OpCode::Add: // derivatives add and subtract just like the values do
+		apply_to_batch<add_lanes>(left.value, right.value);
+		apply_to_batch<add_lanes>(left.dx, right.dx);
+		apply_to_batch<add_lanes>(left.dy, right.dy);
+		break;
+	case OpCode::Subtract:
+		apply_to_batch<subtract_lanes>(left.value, right.value);
+		apply_to_batch<subtract_lanes>(left.dx, right.dx);
+		apply_to_batch<subtract_lanes>(left.dy, right.dy);
+		break;
+	case OpCode::Multiply:
+		multiply_dual_batches(left, right);
+		break;
+	case OpCode::Divide:
+		divide_dual_batches(left, right);
+		break;
+	case OpCode::Power:
+		power_dual_batches(left, right);
+		break;
+	case OpCode::IntegerPower:
+		integer_power_dual_batch(left, instruction.operand);
+		break;
+	default: // instructions that push a value are not operations
+		assert(false);
+		break;
+	}
+}
+
+Interval ExpressionProgram::evaluate_interval(const Interval& x, const Interval& y) const
+{
+	assert(!mInstructions_.empty());
+
+	Interval stack[maxStackDepth];
+	int top = -1;
+
+	for (const Instruction& instruction : mInstructions_)
+	{
+		switch (instruction.opCode)
+		{
+		case OpCode::PushConstant:
+			stack[++top] = Interval::point(instruction.constant);
+			break;
+		case OpCode::PushX:
+			stack[++top] = x;
+			break;
+		case OpCode::PushY:
+			stack[++top] = y;
+			break;
+		case OpCode::Add:
+			stack[top - 1] = Interval::add(stack[top - 1], stack[top]);
+			top--;
+			break;
+		case OpCode::Subtract:
+			stack[top - 1] = Interval::subtract(stack[top - 1], stack[top]);
+			top--;
+			break;
+		case OpCode::Multiply:
+			stack[top - 1] = Interval::multiply(stack[top - 1], stack[top]);
+			top--;
+			break;
+		case OpCode::Divide:
+			stack[top - 1] = Interval::divide(stack[top - 1], stack[top]);
+			top--;
+			break;
+		case OpCode::Power:
+			stack[top - 1] = Interval::power(stack[top - 1], stack[top]);
+			top--;
+			break;
+		case OpCode::IntegerPower:
+			stack[top] = Interval::integer_power(stack[top], instruction.operand);
+			break;
+		case OpCode::PushRowValue:
+			stack[++top] = mRowPrograms_[instruction.operand].evaluate_interval(x, y);
+			break;
+		}
+	}
+
+	return stack[0];
+}
+
+bool ExpressionProgram::is_empty() const
+{
+	return mInstructions_.empty();
+}
+
+int ExpressionProgram::get_stack_depth() const
+{
+	return mStackDepth_;
+}
+
+const std::vector<Instruction>& ExpressionProgram::get_instructions() const
+{
+	return mInstructions_;
+}
+
+const std::vector<ExpressionProgram>& ExpressionProgram::get_row_programs() const
+{
+	return mRowPrograms_;
+}
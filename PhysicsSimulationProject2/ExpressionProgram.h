@@ -0,0 +1,149 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cassert>
+
+#include "Interval.h"
+
+// The operations that a compiled expression can perform
+enum class OpCode : unsigned char
+{
+	PushConstant, // pushes the instruction's constant onto the stack
+	PushX, // pushes the x coordinate of the current sample onto the stack
+	PushY, // pushes the y coordinate of the current sample onto the stack
+	Add,
+	Subtract,
+	Multiply,
+	Divide,
+	Power,
+	IntegerPower, // raises the top of the stack to the instruction's operand using multiplications, produced by the ExpressionOptimiser
+	PushRowValue // pushes a value that only depends on x, calculated once per row of samples, see ExpressionProgram::prepare_row
+};
+
+// The kinds of token that InputHandler::verify_and_convert_function splits an expression into
+enum class TokenKind : unsigned char
+{
+	Number,
+	X,
+	Y,
+	Add,
+	Subtract,
+	Multiply,
+	Divide,
+	Power
+};
+
+struct Token
+{
+	TokenKind kind;
+	float value; // only used by TokenKind::Number, the number is converted from text once while parsing
+};
+
+struct Instruction
+{
+	OpCode opCode;
+	float constant; // only used by OpCode::PushConstant
+	int operand; // the exponent of OpCode::IntegerPower, or the index of the row value pushed by OpCode::PushRowValue
+};
+
+/**
+ * \brief A postfix expression that has been compiled once into a flat array of instructions, so that it can be evaluated
+ * for every sample without having to parse any strings
+ */
+class ExpressionProgram
+{
+public:
+	static constexpr int maxStackDepth = 128; // a 256 character input can never contain more than 128 operands
+	static constexpr int batchSize = 16; // the number of samples that evaluate_batch runs through each instruction at once
+	static constexpr int maxRowValues = 16; // the most subexpressions that can be hoisted out of a row
+
+	/**
+	 * \brief The values of a program's row programs for one value of x, each one repeated four times so that the JIT can load it straight into a register
+	 */
+	struct RowValues
+	{
+		alignas(16) float value[maxRowValues][4];
+		alignas(16) float dx[maxRowValues][4]; // the derivative with respect to x, row values never depend on y
+	};
+
+	// One value of the gradient interpreter for a whole batch of points, a dual number a + a'e holding a value and its derivatives with respect to x and y
+	struct DualBatch
+	{
+		alignas(32) float value[batchSize];
+		alignas(32) float dx[batchSize];
+		alignas(32) float dy[batchSize];
+	};
+
+	ExpressionProgram();
+
+	/**
+	 * \brief Converts the output of the shunting yard algorithm into a program
+	 * \param postfixExpression - the expression in reverse polish notation, e.g. { 2, x, * }
+	 * \param errorFlag - set to true if the expression is not valid postfix
+	 * \return the compiled program, which will be empty if the postfix expression was empty or invalid
+	 */
+	static ExpressionProgram compile(const std::vector<Token>& postfixExpression, bool* errorFlag);
+
+	/**
+	 * \brief Builds a program from instructions that have already been generated, used by the ExpressionOptimiser
+	 * \param instructions - a valid postfix program that leaves exactly one value on the stack
+	 * \param rowPrograms - the programs that calculate the values pushed by OpCode::PushRowValue, they may only use x and constants
+	 */
+	static ExpressionProgram from_instructions(std::vector<Instruction> instructions, std::vector<ExpressionProgram> rowPrograms);
+
+	/**
+	 * \brief Calculates every row value once, so that a whole row of samples sharing the same x can skip the instructions that only depend on x
+	 * \param x - the x coordinate shared by every sample in the row
+	 * \param rowValues - where the values are written, only the first get_row_programs().size() are used
+	 */
+	void prepare_row(float x, RowValues* rowValues) const;
+
+	float evaluate(float x, float y) const; // evaluates the program at a single point, no heap allocation takes place
+
+	/**
+	 * \brief Evaluates the program at many points, executing each instruction over a whole batch of points using SIMD
+	 * \param x - the x coordinate of every point
+	 * \param y - the y coordinate of every point
+	 * \param output - where the z value of every point is written, must have space for count floats
+	 * \param count - the number of points, does not need to be a multiple of batchSize
+	 * \param rowValues - optional, prepared by prepare_row for the x value shared by every point. Without it the row programs are run for every point
+	 */
+	void evaluate_batch(const float* x, const float* y, float* output, int count, const RowValues* rowValues = nullptr) const;
+
+	/**
+	 * \brief The same as evaluate_batch, but every value is carried as a dual number so the partial derivatives come out of the same pass
+	 * \param dzdx - where the derivative of z with respect to x at every point is written, must have space for count floats
+	 * \param dzdy - where the derivative of z with respect to y at every point is written, must have space for count floats
+	 */
+	void evaluate_batch_with_gradient(const float* x, const float* y, float* output, float* dzdx, float* dzdy, int count, const RowValues* rowValues = nullptr) const;
+
+	/**
+	 * \brief Evaluates the program over a whole rectangle of the graph at once using interval arithmetic
+	 * \param x - the range of x covered by the rectangle
+	 * \param y - the range of y covered by the rectangle
+	 * \return bounds that every sample taken inside the rectangle is guaranteed to lie within, unbounded if the rectangle may contain a pole
+	 */
+	Interval evaluate_interval(const Interval& x, const Interval& y) const;
+
+	/**
+	 * \brief Applies an operation to two dual batches, for evaluators that keep their values somewhere other than a stack
+	 * \param instruction - any instruction that does not push a value
+	 * \param left - the left operand, overwritten by the result
+	 * \param right - the right operand, ignored by OpCode::IntegerPower
+	 */
+	static void apply_dual_operation(const Instruction& instruction, DualBatch& left, const DualBatch& right);
+
+	bool is_empty() const;
+	int get_stack_depth() const; // the maximum number of values that will be on the stack at the same time
+	const std::vector<Instruction>& get_instructions() const;
+	const std::vector<ExpressionProgram>& get_row_programs() const;
+
+private:
+	void evaluate_full_batch(const float* x, const float* y, float* output, const RowValues* rowValues) const; // evaluates exactly batchSize points
+	void evaluate_full_batch_with_gradient(const float* x, const float* y, float* output, float* dzdx, float* dzdy, const RowValues* rowValues) const;
+
+	std::vector<Instruction> mInstructions_;
+	std::vector<ExpressionProgram> mRowPrograms_; // hoisted subexpressions that only depend on x, empty unless the program was optimised
+	int mStackDepth_;
+};
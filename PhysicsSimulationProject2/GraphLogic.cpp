@@ -1,186 +1,375 @@
 #include "GraphLogic.h"
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 
-bool GraphLogic::is_operator(const char& characterToCheck)
+namespace
 {
-    switch (characterToCheck)
+    // The triangle indices of a sampleSize * sampleSize grid, as a plain array so that they can be built by a constexpr function 
+    template <int sampleSize>
+    struct GridIndexArray
     {
-    case '^':
-    case '+':
-    case '-':
-    case '*':
-    case '/':
-        return true;
-    default:
-        return false;
+        unsigned int indices[6 * (sampleSize - 1) * (sampleSize - 1)];
+    };
+
+    template <int sampleSize>
+    constexpr GridIndexArray<sampleSize> generate_grid_indices()
+    {
+        GridIndexArray<sampleSize> result = {};
+        int position = 0;
+
+        // We iterate till sampleSize - 1 as opposed to sampleSize, because we do not want to create triangles using the top boundary or the right boundary
+        // The triangles are ordered row by row, so the triangles between the first k rows are the first 6 * (sampleSize - 1) * (k - 1) indices 
+        for (int j = 0; j < sampleSize - 1; j++)
+        {
+            for (int i = 0; i < sampleSize - 1; i++)
+            {
+                // here 'i' and 'j' are just logical indexes for a '2D' array even though our array is 3D in reality
+                const unsigned int index = i + j * sampleSize; // converting logical index into a physical index
+
+                // using Method 1 (mentioned in documentation) 
+                result.indices[position++] = index;
+                result.indices[position++] = index + sampleSize + 1;
+                result.indices[position++] = index + 1;
+
+                // using Method 2 
+                result.indices[position++] = index;
+                result.indices[position++] = index + sampleSize;
+                result.indices[position++] = index + sampleSize + 1;
+            }
+        }
+        return result;
     }
+
+    // The sizes used by the Low, Medium and High settings are built by the compiler and stored in the executable 
+    constexpr GridIndexArray<20> lowGridIndices = generate_grid_indices<20>();
+    constexpr GridIndexArray<40> mediumGridIndices = generate_grid_indices<40>();
+    constexpr GridIndexArray<80> highGridIndices = generate_grid_indices<80>();
+
+    // every other size, from when it is first asked for until its indices have been uploaded, see GraphLogic::release_grid_indices 
+    std::mutex cachedIndicesMutex;
+    std::map<int, std::vector<unsigned int>> cachedIndices;
 }
 
+/**
+ * \brief This function generates the relevant data needed to visualise the graph, which can then be sent to the GPU
+ * \param program The expression that the user wants visualised, compiled from its postfix form 
+ * \param sampleSize The number of samples taken along each axis, so sampleSize * sampleSize samples are taken in total 
+ * \return 
+ */
+std::vector<GraphVertex> GraphLogic::sample_points(const ExpressionProgram& program, int sampleSize)
+{
+    return sample_grid(program, program.is_empty(), get_grid_window({ 0.f, 0.f, 0 }, sampleSize), nullptr);
+}
 
-float GraphLogic::eval_postfix_expression(std::vector<std::string> input)
+std::vector<GraphVertex> GraphLogic::sample_points(const ExpressionJit& evaluator, const GridWindow& window, const std::atomic<bool>* cancelFlag)
 {
-    //assert(input.size() != 0); // calls abort() if a 0 length string is passed as the validation does not check for this 
+    return sample_grid(evaluator, evaluator.get_program().is_empty(), window, cancelFlag);
+}
+
+int GraphLogic::clamp_sample_size(int sampleSize)
+{
+    return std::min(std::max(sampleSize, (int)minSampleSize), (int)maxSampleSize);
+}
+
+GridWindow GraphLogic::get_grid_window(const GraphDomain& domain, int sampleSize)
+{
+    if (sampleSize < minSampleSize || sampleSize > maxSampleSize) abort(); // invalid sample size was entered 
+
+    // The samples are spread over the same area whatever the resolution, so the spacing shrinks as the sample size grows. 
+    // Zooming scales it by a power of two, which is exact, so every sample of a zoomed out window is also a sample of the window it was zoomed out from 
+    const float spacing = std::ldexp(domainWidth / sampleSize, domain.zoomLevel);
+
+    GridWindow window;
+    window.sampleSize = sampleSize;
+    window.zoomLevel = domain.zoomLevel;
+    window.firstRow = (int)std::floor(domain.centreX / spacing + 0.5f) - sampleSize / 2; // the lattice point nearest the centre is in the middle of the grid 
+    window.firstColumn = (int)std::floor(domain.centreY / spacing + 0.5f) - sampleSize / 2;
+    window.spacing = spacing;
+
+    return window;
+}
+
+template <typename Evaluator>
+std::vector<GraphVertex> GraphLogic::sample_grid(const Evaluator& evaluator, bool isEmpty, const GridWindow& window, const std::atomic<bool>* cancelFlag)
+{
+    if (isEmpty) return {}; // the user entered an empty expression 
+
+    const int sampleSize = window.sampleSize;
+
+    // The array is sized up front so that every tile can write its points straight into their final position, without any locking 
+    std::vector<GraphVertex> outputPoints(sampleSize * sampleSize); // this will be the object that the function returns
+
+    std::vector<float> rowY(sampleSize); // the y values are the same for every row, so they are only calculated once 
+    for (int j = 0; j < sampleSize; j++)
+    {
+        rowY[j] = (float)(window.firstColumn + j) * window.spacing; 
+    }
 
-    std::stack<std::string> stack; // A stack is used to decompose the postfix expression 
+    // Every grid point is independent, so the grid is split into tiles of whole rows which are sampled in parallel. 
+    // A row always produces the same values no matter which thread samples it, so the result is identical to sampling serially 
+    const int tileCount = (sampleSize + rowsPerTile - 1) / rowsPerTile;
 
-    for (std::string x : input)
+    ThreadPool::get_shared_pool().parallel_for(tileCount, [&](int tile)
     {
-        if (x.size() == 1)
+        if (cancelFlag != nullptr && *cancelFlag) return; // the result is no longer wanted, so the remaining tiles are skipped 
+
+        // Every sample in a row shares the same x value, so a whole row is sent through the program in batches 
+        std::vector<float> rowX(sampleSize);
+        std::vector<float> rowZ(sampleSize);
+        std::vector<float> rowDzdx(sampleSize);
+        std::vector<float> rowDzdy(sampleSize);
+        ExpressionProgram::RowValues rowValues;
+
+        const int firstRow = tile * rowsPerTile;
+        const int lastRow = std::min(firstRow + rowsPerTile, sampleSize);
+
+        for (int row = firstRow; row < lastRow; row++)
         {
-            if (is_operator(x[0]))
-            {
-                // we do not need to check that the stack is not empty, because we assumed from the beginning that the provided input was in valid reverse polish notation 
+            const float xScaled = (float)(window.firstRow + row) * window.spacing;
+            std::fill(rowX.begin(), rowX.end(), xScaled);
 
-                float operand2 = std::stof(stack.top()); // cast stack.top() from string to float 
-                stack.pop();
-                float operand1 = std::stof(stack.top()); // cast stack.top() from string to float 
-                stack.pop();
+            // the parts of the expression that only depend on x are calculated once for the whole row 
+            evaluator.prepare_row(xScaled, &rowValues);
 
-                float result = 0;
+            // the derivatives come out of the same pass as the heights, so the normals cost no extra samples 
+            evaluator.evaluate_batch_with_gradient(rowX.data(), rowY.data(), rowZ.data(), rowDzdx.data(), rowDzdy.data(), sampleSize, &rowValues);
 
-                switch (x[0]) // we now apply the operator 
-                {
-                case '^':
-                    result = pow(operand1, operand2);
-                    break;
-                case '+':
-                    result = operand1 + operand2;
-                    break;
-                case '-':
-                    result = operand1 - operand2;
-                    break;
-                case '*':
-                    result = operand1 * operand2;
-                    break;
-                case '/':
-                    result = operand1 / operand2;
-                    break;
-                default:
-                    abort(); // Something went wrong 
-                }
-                stack.push(std::to_string(result));
-            }
-            else // fixing the issue by an additional condition 
+            GraphVertex* rowPoints = &outputPoints[row * sampleSize];
+            for (int j = 0; j < sampleSize; j++)
             {
-                stack.push(x);
+                rowPoints[j] = { { xScaled, rowZ[j], rowY[j] }, surface_normal(rowDzdx[j], rowDzdy[j]) }; // adding our coordinates to the array 
             }
         }
-        else // Because the size is not 1, we know that we have an operator  
+    });
+
+    assert(outputPoints.size() == sampleSize * sampleSize); // Ensuring that my calculations have not been wrong 
+
+    if (cancelFlag != nullptr && *cancelFlag) return {}; 
+
+    return outputPoints; 
+}
+
+std::vector<std::vector<GraphVertex>> GraphLogic::sample_points(const ExpressionGroup& group, const GridWindow& window, const std::atomic<bool>* cancelFlag)
+{
+    const int sampleSize = window.sampleSize;
+    const int programCount = group.get_program_count();
+    std::vector<std::vector<GraphVertex>> outputPoints(programCount, std::vector<GraphVertex>(sampleSize * sampleSize));
+
+    std::vector<float> rowY(sampleSize); // laid out exactly as sample_grid does 
+    for (int j = 0; j < sampleSize; j++)
+    {
+        rowY[j] = (float)(window.firstColumn + j) * window.spacing;
+    }
+
+    const int tileCount = (sampleSize + rowsPerTile - 1) / rowsPerTile;
+
+    ThreadPool::get_shared_pool().parallel_for(tileCount, [&](int tile)
+    {
+        if (cancelFlag != nullptr && *cancelFlag) return;
+
+        // one row of heights and derivatives for every program in the group 
+        std::vector<float> rowValues(3 * programCount * sampleSize);
+        std::vector<float*> rowZ(programCount);
+        std::vector<float*> rowDzdx(programCount);
+        std::vector<float*> rowDzdy(programCount);
+        for (int program = 0; program < programCount; program++)
         {
-            stack.push(x);
+            rowZ[program] = &rowValues[(3 * program) * sampleSize];
+            rowDzdx[program] = &rowValues[(3 * program + 1) * sampleSize];
+            rowDzdy[program] = &rowValues[(3 * program + 2) * sampleSize];
         }
-    }
 
-    const std::string finalOutput = stack.top();
+        const int firstRow = tile * rowsPerTile;
+        const int lastRow = std::min(firstRow + rowsPerTile, sampleSize);
 
-    return std::stof(finalOutput); // Return the final evaluation as a float 
+        for (int row = firstRow; row < lastRow; row++)
+        {
+            const float xScaled = (float)(window.firstRow + row) * window.spacing;
+
+            group.evaluate_row_with_gradient(xScaled, rowY.data(), sampleSize, rowZ.data(), rowDzdx.data(), rowDzdy.data());
+
+            for (int program = 0; program < programCount; program++)
+            {
+                GraphVertex* rowPoints = &outputPoints[program][row * sampleSize];
+                for (int j = 0; j < sampleSize; j++)
+                {
+                    rowPoints[j] = { { xScaled, rowZ[program][j], rowY[j] }, surface_normal(rowDzdx[program][j], rowDzdy[program][j]) };
+                }
+            }
+        }
+    });
+
+    if (cancelFlag != nullptr && *cancelFlag) return {}; 
+
+    return outputPoints; 
 }
 
-/**
- * \brief This function generates the relevant data needed to visualise the graph, which can then be sent to the GPU
- * \param input The expression that the user wants visualised in postfix form 
- * \param setting The desired performance setting, will determine how MANY samples we will take 
- * \return 
- */
-std::pair<std::vector<glm::vec3>, std::vector<unsigned int>> GraphLogic::sample_points(std::vector<std::string> input, int setting)
+std::vector<GraphVertex> GraphLogic::sample_points(const SeparableProgram& program, const GridWindow& window, const std::atomic<bool>* cancelFlag)
+{
+    std::vector<GraphVertex> outputPoints(window.sampleSize * window.sampleSize);
+
+    sample_rows(program, window, 0, window.sampleSize, outputPoints.data(), cancelFlag);
+
+    if (cancelFlag != nullptr && *cancelFlag) return {}; 
+
+    return outputPoints; 
+}
+
+void GraphLogic::sample_rows(const SeparableProgram& program, const GridWindow& window, int firstRow, int rowCount, GraphVertex* output, const std::atomic<bool>* cancelFlag)
 {
-    if (input.size() == 0) return {}; // the user entered an empty expression 
+    const int sampleSize = window.sampleSize;
 
-    
-    for (auto x : input)
+    std::vector<float> xs(rowCount);
+    std::vector<float> ys(sampleSize);
+    for (int i = 0; i < rowCount; i++)
     {
-        std::cout << x << " "; 
+        xs[i] = (float)(window.firstRow + firstRow + i) * window.spacing;
+    }
+    for (int j = 0; j < sampleSize; j++)
+    {
+        ys[j] = (float)(window.firstColumn + j) * window.spacing;
     }
-    std::cout << std::endl; 
 
+    // Each part only depends on one coordinate, so the other one can take any value and its derivative comes out as zero. The y part is 
+    // evaluated again for every call, which is only sampleSize values next to the rowCount * sampleSize points combined from it 
+    std::vector<float> f(rowCount), dfdx(rowCount), unusedX(rowCount);
+    std::vector<float> g(sampleSize), dgdy(sampleSize), unusedY(sampleSize);
+    program.xPart.evaluate_batch_with_gradient(xs.data(), xs.data(), f.data(), dfdx.data(), unusedX.data(), rowCount);
+    program.yPart.evaluate_batch_with_gradient(ys.data(), ys.data(), g.data(), unusedY.data(), dgdy.data(), sampleSize);
 
-    int sampleSize = 0; // we will be iterating x, y from -sampleSize / 2 to sampleSize / 2
-    switch (setting)
+    const bool isProduct = program.combine == OpCode::Multiply;
+    const int tileCount = (rowCount + rowsPerTile - 1) / rowsPerTile;
+
+    ThreadPool::get_shared_pool().parallel_for(tileCount, [&](int tile)
     {
-    case (1):
-        sampleSize = 20;
-        break; 
-    case (2):
-        sampleSize = 40;
-        break; 
-    case (3):
-        sampleSize = 80; // A higher setting will result in more samples being taken
-        break;
-    default:
-        abort(); // invalid setting input was entered 
-    }
+        if (cancelFlag != nullptr && *cancelFlag) return;
 
+        const int firstTileRow = tile * rowsPerTile;
+        const int lastTileRow = std::min(firstTileRow + rowsPerTile, rowCount);
+
+        for (int row = firstTileRow; row < lastTileRow; row++)
+        {
+            GraphVertex* rowPoints = &output[(size_t)row * sampleSize];
+            const float fRow = f[row];
+            const float dfdxRow = dfdx[row];
 
-    std::vector<glm::vec3> outputPoints; // this will be the object that the function returns
+            // d(f + g)/dx = f', d(f * g)/dx = f' * g, and likewise for y 
+            for (int j = 0; j < sampleSize; j++)
+            {
+                const float z = isProduct ? fRow * g[j] : fRow + g[j];
+                const float dzdx = isProduct ? dfdxRow * g[j] : dfdxRow;
+                const float dzdy = isProduct ? fRow * dgdy[j] : dgdy[j];
 
-    // We are using a dynamic array to which we could be appending 250,000 vec3, This will call many resizes which are expensive
-    // Because we know how many points will be stored inside our array, beforehand, we can tell C++ to reserve space for us, avoiding expensive resize calls 
-    outputPoints.reserve(sampleSize * sampleSize);
+                rowPoints[j] = { { xs[row], z, ys[j] }, surface_normal(dzdx, dzdy) };
+            }
+        }
+    });
+}
 
-    int i = 0; 
-    // iterating over the xy plane
-    for (int x = -sampleSize / 2; x < sampleSize / 2; x++)
+void GraphLogic::sample_spans(const ExpressionJit& evaluator, float spacing, const std::vector<GridSpan>& spans, const std::atomic<bool>* cancelFlag)
+{
+    const int spanCount = (int)spans.size();
+    const int tileCount = (spanCount + rowsPerTile - 1) / rowsPerTile; // spans are usually whole or partial rows, so they are shared out like rows 
+
+    ThreadPool::get_shared_pool().parallel_for(tileCount, [&](int tile)
     {
-        for (int y = -sampleSize / 2; y < sampleSize / 2; y++)
+        if (cancelFlag != nullptr && *cancelFlag) return;
+
+        std::vector<float> spanX, spanY, spanZ, spanDzdx, spanDzdy;
+        ExpressionProgram::RowValues rowValues;
+
+        const int lastSpan = std::min((tile + 1) * rowsPerTile, spanCount);
+
+        for (int i = tile * rowsPerTile; i < lastSpan; i++)
         {
-            std::vector<std::string> tempArr = input;
+            const GridSpan& span = spans[i];
 
-            i++; 
+            spanX.assign(span.count, (float)span.row * spacing);
+            spanY.resize(span.count);
+            spanZ.resize(span.count);
+            spanDzdx.resize(span.count);
+            spanDzdy.resize(span.count);
 
-            // Scaling our graph down 
-            float xScaled = (float)x / (sampleSize / 10.f); 
-            float yScaled = (float)y / (sampleSize / 10.f); 
+            for (int j = 0; j < span.count; j++)
+            {
+                spanY[j] = (float)(span.firstColumn + j * span.columnStep) * spacing; // exactly the positions used by sample_grid 
+            }
 
-            // we go through the string here, when ever we see x we replace it with the numerical value of x, vice versa for y
-            for (int i = 0; i < tempArr.size(); i++)
+            evaluator.prepare_row(spanX[0], &rowValues);
+            evaluator.evaluate_batch_with_gradient(spanX.data(), spanY.data(), spanZ.data(), spanDzdx.data(), spanDzdy.data(), span.count, &rowValues);
+
+            for (int j = 0; j < span.count; j++)
             {
-                if (input[i] == "x")
-                {
-                    tempArr[i] = std::to_string(xScaled);
-                }
-                else if (input[i] == "y")
-                {
-                    tempArr[i] = std::to_string(yScaled);
-                }
+                span.output[j * span.columnStep] = { { spanX[j], spanZ[j], spanY[j] }, surface_normal(spanDzdx[j], spanDzdy[j]) };
             }
+        }
+    });
+}
 
-            // printing the tempArr
+glm::vec3 GraphLogic::surface_normal(float dzdx, float dzdy)
+{
+    const glm::vec3 normal = { -dzdx, 1.f, -dzdy }; // the graph's y axis is drawn along world z 
 
-            float z = eval_postfix_expression(tempArr);
+    if (!std::isfinite(normal.x) || !std::isfinite(normal.z)) return { 0.f, 1.f, 0.f };
 
+    return glm::normalize(normal);
+}
 
-            outputPoints.push_back({ (float)xScaled, z, (float)yScaled }); // adding our coordinates to the array 
-        }
+unsigned int GraphLogic::get_grid_index_count(int sampleSize)
+{
+    return 6 * (sampleSize - 1) * (sampleSize - 1);
+}
+
+unsigned int GraphLogic::get_grid_row_index_count(int sampleSize, int rowCount)
+{
+    return rowCount < 2 ? 0 : 6 * (sampleSize - 1) * (rowCount - 1);
+}
 
+const unsigned int* GraphLogic::get_grid_indices(int sampleSize)
+{
+    switch (sampleSize)
+    {
+    case 20:
+        return lowGridIndices.indices;
+    case 40:
+        return mediumGridIndices.indices;
+    case 80:
+        return highGridIndices.indices;
+    default:
+        break;
     }
 
-    std::cout << "i: " << i << std::endl; 
+    // Any other size is generated the first time it is asked for, and kept until it is released 
+    std::lock_guard<std::mutex> lock(cachedIndicesMutex);
 
-    assert(outputPoints.size() == sampleSize * sampleSize); // Ensuring that my calculations have not been wrong 
+    std::vector<unsigned int>& indexBufferData = cachedIndices[sampleSize];
+    if (indexBufferData.empty())
+    {
+        indexBufferData.reserve(get_grid_index_count(sampleSize));
 
-    // Creating Index Buffer Data 
+        for (int j = 0; j < sampleSize - 1; j++)
+        {
+            for (int i = 0; i < sampleSize - 1; i++)
+            {
+                unsigned int index = i + j * sampleSize; // the same layout and order as generate_grid_indices 
 
-    std::vector<unsigned int> indexBufferData;
+                indexBufferData.push_back(index);
+                indexBufferData.push_back(index + sampleSize + 1);
+                indexBufferData.push_back(index + 1);
 
-    // We iterate till sampleSize - 1 as opposed to sampleSize, because we do not want to create triangles using the top boundary or the right boundary
-    for (int i = 0; i < sampleSize - 1; i++)
-    {
-	    for (int j = 0; j < sampleSize - 1; j++)
-	    {
-            // here 'i' and 'j' are just logical indexes for a '2D' array even though our array is 3D in reality
-            unsigned int index = i + j * sampleSize; // converting logical index into a physical index
-
-            // using Method 1 (mentioned in documentation) 
-            indexBufferData.push_back(index);
-            indexBufferData.push_back(index + sampleSize + 1);
-            indexBufferData.push_back(index + 1);
-
-            // using Method 2 
-            indexBufferData.push_back(index);
-            indexBufferData.push_back(index + sampleSize);
-            indexBufferData.push_back(index + sampleSize + 1); 
-	    }
+                indexBufferData.push_back(index);
+                indexBufferData.push_back(index + sampleSize);
+                indexBufferData.push_back(index + sampleSize + 1);
+            }
+        }
     }
 
-    return { outputPoints, indexBufferData }; 
-}
\ No newline at end of file
+    return indexBufferData.data();
+}
+
+void GraphLogic::release_grid_indices(int sampleSize)
+{
+    std::lock_guard<std::mutex> lock(cachedIndicesMutex);
+    cachedIndices.erase(sampleSize); // does nothing for the compile time sizes, which are never in the map 
+}
@@ -6,31 +6,139 @@
 #include <cmath> 
 #include <cassert> 
 #include <utility>
+#include <atomic>
+#include <map>
+#include <mutex>
 
 #include "glm/glm.hpp"
 
+#include "ExpressionProgram.h"
+#include "ExpressionJit.h"
+#include "ExpressionGroup.h"
+#include "ExpressionOptimiser.h"
+#include "ThreadPool.h"
+
+// A vertex of a graph's mesh, the normal is interleaved with the position so the GPU reads both from the same buffer 
+struct GraphVertex
+{
+	glm::vec3 position; 
+	glm::vec3 normal; // the unit normal of the surface, found exactly from the expression's derivatives rather than from neighbouring samples 
+};
+
+// The part of the plane that is graphed. Every zoom level doubles the domain's width, so the samples of neighbouring levels line up and can be reused 
+struct GraphDomain
+{
+	float centreX; 
+	float centreY; 
+	int zoomLevel; // at level 0 the domain is 10 wide, as it was before it could be moved, negative levels zoom in 
+};
+
+/**
+ * \brief The points sampled for a domain at a given resolution. They lie on a lattice, the point in row i and column j of the grid is at 
+ * x = (firstRow + i) * spacing and y = (firstColumn + j) * spacing, so a sample's position only depends on its lattice indices 
+ * and overlapping windows share their samples exactly 
+ */
+struct GridWindow
+{
+	int sampleSize; 
+	int zoomLevel; 
+	int firstRow; 
+	int firstColumn; 
+	float spacing; 
+};
+
+// A run of lattice points along one row, sampled by GraphLogic::sample_spans 
+struct GridSpan
+{
+	int row; // the lattice row, x = row * spacing 
+	int firstColumn; 
+	int columnStep; // 1 to sample every column, 2 to sample every other column 
+	int count; 
+	GraphVertex* output; // the sample in lattice column firstColumn + j * columnStep is written to output[j * columnStep] 
+};
+
 class GraphLogic
 {
 public:
 
+	static const int minSampleSize = 2; // the fewest samples along each axis that still form a triangle 
+	static const int maxSampleSize = 2048; 
+	static constexpr float domainWidth = 10.f; // the width of the domain at zoom level 0 
+	static const int minZoomLevel = -10; 
+	static const int maxZoomLevel = 10; 
+
+	// brings a resolution typed in by the user into [minSampleSize, maxSampleSize], every sampler assumes it is in range 
+	static int clamp_sample_size(int sampleSize); 
+
+	/**
+	 * \brief Finds the lattice points covering a domain, the window is snapped to the lattice so that moving the domain keeps the same sample positions 
+	 * \param sampleSize - the number of samples along each axis, between minSampleSize and maxSampleSize 
+	 */
+	static GridWindow get_grid_window(const GraphDomain& domain, int sampleSize); 
+
 	/**
 	 * \brief Takes in abstract graph data and generates an array of coordinates form this data, from which the graph can be draw 
-	 * \param input - it is assumed that the input list provided has already been validated by the input handler class 
-	 * \param setting - Either a 1, 2 or 3 (There are three performance settings) 
-	 * \return a vector that contains all points needed to draw the graph
+	 * \param program - the compiled expression, it is assumed that it was compiled from input validated by the input handler class 
+	 * \param sampleSize - the number of samples taken along each axis, between minSampleSize and maxSampleSize 
+	 * \return a vector that contains all points needed to draw the graph, they are connected by the indices from get_grid_indices(sampleSize)
 	 */
-	static std::pair<std::vector<glm::vec3>, std::vector<unsigned int>> sample_points(std::vector<std::string> input, int setting);
+	static std::vector<GraphVertex> sample_points(const ExpressionProgram& program, int sampleSize);
 
-private:
+	// Similar to the function above, but samples any window and evaluates the expression using native code when the JIT was able to compile it 
+	// cancelFlag - optional, if it becomes true while sampling, sampling stops early and the returned data must be ignored 
+	static std::vector<GraphVertex> sample_points(const ExpressionJit& evaluator, const GridWindow& window, const std::atomic<bool>* cancelFlag = nullptr);
 
-	static bool is_operator(const char& characterToCheck); // checks if the character provided as an argument, is a valid operator 
+	/**
+	 * \brief Samples every program in a group over the same grid, so each distinct subexpression is only calculated once per sample 
+	 * \param group - the programs to sample, it must be valid 
+	 * \return the points of every program, in the order they were given to the group, or nothing if sampling was cancelled 
+	 */
+	static std::vector<std::vector<GraphVertex>> sample_points(const ExpressionGroup& group, const GridWindow& window, const std::atomic<bool>* cancelFlag = nullptr);
+
+	/**
+	 * \brief Samples a separable expression, each part is only evaluated sampleSize times and the points combine the two parts with a single operation 
+	 * \param program - split by ExpressionOptimiser::separate 
+	 * \return the same points as the other overloads, up to rounding, or nothing if sampling was cancelled 
+	 */
+	static std::vector<GraphVertex> sample_points(const SeparableProgram& program, const GridWindow& window, const std::atomic<bool>* cancelFlag = nullptr);
+
+	/**
+	 * \brief Samples some of the rows of a separable expression's grid, so a grid too large to hold whole can be handed over a few rows at a time 
+	 * \param output - rowCount * window.sampleSize points, starting with the window's row firstRow 
+	 */
+	static void sample_rows(const SeparableProgram& program, const GridWindow& window, int firstRow, int rowCount, GraphVertex* output, const std::atomic<bool>* cancelFlag = nullptr);
+
+	/**
+	 * \brief Samples separate runs of lattice points, used to fill in only the parts of a grid that are not already known, see GridSampleCache 
+	 * \param spacing - the distance between neighbouring lattice points 
+	 */
+	static void sample_spans(const ExpressionJit& evaluator, float spacing, const std::vector<GridSpan>& spans, const std::atomic<bool>* cancelFlag = nullptr);
+
+	/**
+	 * \brief The triangle indices of a grid only depend on its size, so they are generated once for every size and shared by every graph.
+	 * The sizes used by the High, Medium and Low settings are generated at compile time. The triangles are ordered row by row, so the
+	 * first get_grid_row_index_count(sampleSize, k) indices draw the first k rows on their own
+	 * \param sampleSize - the number of samples along each axis
+	 * \return get_grid_index_count(sampleSize) indices, the memory stays valid until release_grid_indices(sampleSize) is called
+	 */
+	static const unsigned int* get_grid_indices(int sampleSize);
+	static void release_grid_indices(int sampleSize); // frees a generated size once its indices have been uploaded, the compile time sizes are never freed
+	static unsigned int get_grid_index_count(int sampleSize); // two triangles for every square in the grid
+	static unsigned int get_grid_row_index_count(int sampleSize, int rowCount); // the triangles between the first rowCount rows of the grid
 
 	/**
-	 * \brief 
-	 * \param input - will be in reverse polish notation, but will only contain numerical values as opposed to 'x' and 'y'
-	 * \return 
+	 * \brief The surface z = f(x, y) is drawn with z pointing up, so its normal in world space is (-dz/dx, 1, -dz/dy) normalised 
+	 * \return the unit normal, or straight up where the derivatives are not finite, e.g. at a pole 
 	 */
-	static float eval_postfix_expression(std::vector<std::string> input); // we are assuming that the input has already been validated 
+	static glm::vec3 surface_normal(float dzdx, float dzdy);
+
+private:
+
+	static const int rowsPerTile = 8; // the number of grid rows sampled by each task given to the thread pool 
+
+	// Evaluator can be anything that provides prepare_row and evaluate_batch_with_gradient, so the same sampling loop is used by the interpreter and the JIT 
+	template <typename Evaluator>
+	static std::vector<GraphVertex> sample_grid(const Evaluator& evaluator, bool isEmpty, const GridWindow& window, const std::atomic<bool>* cancelFlag);
 };
 
 
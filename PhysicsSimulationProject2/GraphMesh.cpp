@@ -0,0 +1,537 @@
+#include "GraphMesh.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "glm/gtc/packing.hpp"
+
+namespace
+{
+	const size_t stagingBufferBytes = 32 << 20; // a 1000 * 1000 grid fits in one piece, larger meshes are written a piece at a time
+	const float streamedHeightHeadroom = 256.f; // how much higher a streamed grid can go before its rows are rescaled again
+
+	// The height near the middle of the grid, heights are stored as their distance from it so that a half float keeps its precision however high the graph is
+	float choose_height_offset(const std::vector<GraphVertex>& vertices)
+	{
+		const float middle = vertices[vertices.size() / 2].position.y;
+		if (std::isfinite(middle)) return middle;
+
+		for (const GraphVertex& vertex : vertices)
+		{
+			if (std::isfinite(vertex.position.y)) return vertex.position.y;
+		}
+
+		return 0.f; // nothing to keep precise
+	}
+
+	// The smallest power of two that brings every finite height within a half float of the offset, a half float overflows past 65504 so
+	// x^8 or a zoomed out x^2 + y^2 would otherwise be drawn as infinities. Scaling by a power of two only changes the exponent, so it is exact
+	float choose_height_scale(const std::vector<GraphVertex>& vertices, float heightOffset)
+	{
+		const double largestPackedHeight = 32768.0; // the largest power of two a half float holds
+
+		double largestDistance = 0.0; // a double, so heights far either side of the offset cannot overflow
+		for (const GraphVertex& vertex : vertices)
+		{
+			if (std::isfinite(vertex.position.y)) largestDistance = std::max(largestDistance, std::fabs((double)vertex.position.y - heightOffset));
+		}
+
+		if (largestDistance <= largestPackedHeight) return 1.f;
+
+		int exponent;
+		std::frexp(largestDistance / largestPackedHeight, &exponent); // the ratio is below 2^exponent
+		return std::ldexp(1.f, exponent);
+	}
+
+	// A grid vertex in 32 bits: the height above the offset, divided by the scale, as a half float, then the normal folded onto the octahedron
+	// |x| + |y| + |z| = 1 as two signed bytes. A graph's normals always point up, see GraphLogic::surface_normal, so the upper half of the octahedron is enough
+	unsigned int pack_grid_vertex(const GraphVertex& vertex, float heightOffset, float heightScale)
+	{
+		const glm::vec3& normal = vertex.normal;
+		const glm::vec2 folded = glm::vec2(normal.x, normal.z) / (std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z));
+		const float height = (float)(((double)vertex.position.y - heightOffset) / heightScale);
+
+		return glm::packHalf1x16(height) | ((unsigned int)glm::packSnorm2x8(folded) << 16); // unpacked by grid_vertex_shader.txt
+	}
+}
+
+std::map<int, unsigned int> GraphMesh::mGridIndexBuffers_;
+long long GraphMesh::mLiveBufferBytes_ = 0;
+
+GraphMesh::GraphMesh(int graphCount) :
+	mGridVao_(0),
+	mMeshVao_(0),
+	mGridVertices_{ 0, 0, 0, sizeof(unsigned int) },
+	mMeshVertices_{ 0, 0, 0, sizeof(GraphVertex) },
+	mIndices_{ 0, 0, 0, sizeof(unsigned int) },
+	mGraphs_(graphCount, Graph()),
+	mCommandBuffer_(0),
+	mGridCommandCount_(0),
+	mLayoutBuffer_(0),
+	mLayouts_(graphCount, GridLayout()),
+	mCommandsChanged_(false)
+{
+	mCommands_.reserve(graphCount);
+}
+
+GraphMesh::~GraphMesh()
+{
+	// GL objects cannot be deleted here, the context may already be gone, so release() must have been called
+	assert(mGridVao_ == 0 && mMeshVao_ == 0 && mCommandBuffer_ == 0 && mLayoutBuffer_ == 0);
+	assert(mGridVertices_.buffer == 0 && mMeshVertices_.buffer == 0 && mIndices_.buffer == 0);
+}
+
+void GraphMesh::upload(int graph, const std::vector<GraphVertex>& vertices, const GridWindow& window)
+{
+	Graph& mesh = mGraphs_[graph];
+	mCommandsChanged_ = true;
+
+	if (vertices.empty()) // the user cleared the graph, its ranges are kept for the next mesh
+	{
+		mesh.indexCount = 0;
+		return;
+	}
+
+	create_objects();
+
+	const float heightOffset = choose_height_offset(vertices);
+	set_grid(&mesh, window, heightOffset, choose_height_scale(vertices, heightOffset));
+
+	reserve(&mGridVertices_, &mesh.gridVertices, vertices.size());
+	write_grid_vertices(mesh, 0, vertices);
+
+	mesh.indexCount = GraphLogic::get_grid_index_count(window.sampleSize);
+}
+
+void GraphMesh::upload(int graph, const std::vector<GraphVertex>& vertices, const std::vector<unsigned int>& indices)
+{
+	Graph& mesh = mGraphs_[graph];
+	mCommandsChanged_ = true;
+
+	if (vertices.empty() || indices.empty())
+	{
+		mesh.indexCount = 0;
+		return;
+	}
+
+	create_objects();
+
+	mesh.isGrid = false;
+
+	reserve(&mMeshVertices_, &mesh.meshVertices, vertices.size());
+	write(mMeshVertices_.buffer, sizeof(GraphVertex) * mesh.meshVertices.offset, vertices.data(), sizeof(GraphVertex) * vertices.size());
+
+	reserve(&mIndices_, &mesh.indices, indices.size());
+	write(mIndices_.buffer, sizeof(unsigned int) * mesh.indices.offset, indices.data(), sizeof(unsigned int) * indices.size()); // relative to the graph's first vertex, see draw()
+
+	mesh.indexCount = (unsigned int)indices.size();
+}
+
+void GraphMesh::upload_rows(int graph, const std::vector<GraphVertex>& vertices, const GridWindow& window, int firstRow)
+{
+	if (vertices.empty()) return;
+
+	Graph& mesh = mGraphs_[graph];
+	mCommandsChanged_ = true;
+
+	const int sampleSize = window.sampleSize;
+
+	create_objects();
+
+	const float heightOffset = firstRow == 0 ? choose_height_offset(vertices) : mesh.layout.heightOffset; // the first chunk is the only one known so far
+	const float heightScale = choose_height_scale(vertices, heightOffset);
+
+	if (firstRow == 0) // room is made for the whole grid, so the later rows are written straight into place 
+	{
+		set_grid(&mesh, window, heightOffset, heightScale);
+		reserve(&mGridVertices_, &mesh.gridVertices, (size_t)sampleSize * sampleSize);
+	}
+	else if (heightScale > mesh.layout.heightScale) // a later chunk goes higher than the rows before it were packed for 
+	{
+		rescale_grid(&mesh, (size_t)firstRow * sampleSize, heightScale * streamedHeightHeadroom);
+	}
+
+	write_grid_vertices(mesh, (size_t)firstRow * sampleSize, vertices);
+
+	// the grid's indices are ordered row by row, so only the rows that have arrived are drawn 
+	const int rowCount = firstRow + (int)(vertices.size() / sampleSize);
+	mesh.indexCount = GraphLogic::get_grid_row_index_count(sampleSize, rowCount);
+}
+
+void GraphMesh::create_objects()
+{
+	if (mGridVao_ != 0) return; // the objects are only created once, on the first upload
+
+	// The GPU is given a stream of data but does not know how to deal with it. The formats are set once, so moving an arena to a new 
+	// buffer only needs the buffer to be swapped, see repack 
+	glCreateVertexArrays(1, &mGridVao_);
+	glVertexArrayAttribIFormat(mGridVao_, 0, 1, GL_UNSIGNED_INT, 0); // the packed vertex is read as an integer, grid_vertex_shader.txt unpacks it
+	glVertexArrayAttribBinding(mGridVao_, 0, 0);
+	glEnableVertexArrayAttrib(mGridVao_, 0);
+
+	glCreateVertexArrays(1, &mMeshVao_);
+	glVertexArrayAttribFormat(mMeshVao_, 0, 3, GL_FLOAT, GL_FALSE, offsetof(GraphVertex, position));
+	glVertexArrayAttribBinding(mMeshVao_, 0, 0);
+	glEnableVertexArrayAttrib(mMeshVao_, 0);
+	glVertexArrayAttribFormat(mMeshVao_, 1, 3, GL_FLOAT, GL_FALSE, offsetof(GraphVertex, normal)); // the normal sits after the position in each vertex 
+	glVertexArrayAttribBinding(mMeshVao_, 1, 0);
+	glEnableVertexArrayAttrib(mMeshVao_, 1);
+
+	const size_t commandBytes = sizeof(DrawCommand) * mGraphs_.size();
+	const size_t layoutBytes = sizeof(GridLayout) * mLayouts_.size();
+
+	glCreateBuffers(1, &mCommandBuffer_);
+	glNamedBufferStorage(mCommandBuffer_, commandBytes, nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+	glCreateBuffers(1, &mLayoutBuffer_);
+	glNamedBufferStorage(mLayoutBuffer_, layoutBytes, nullptr, GL_DYNAMIC_STORAGE_BIT);
+	glBindBufferBase(GL_UNIFORM_BUFFER, gridBinding, mLayoutBuffer_); // stays bound, as the scene buffer does
+
+	mStaging_.create(stagingBufferBytes);
+
+	mLiveBufferBytes_ += (long long)(commandBytes + layoutBytes + stagingBufferBytes);
+}
+
+void GraphMesh::write(unsigned int buffer, size_t byteOffset, const void* data, size_t byteCount)
+{
+	const unsigned char* source = (const unsigned char*)data;
+
+	// a piece is at most half the ring, so the next piece can be written while the GPU is still copying this one 
+	const size_t pieceBytes = mStaging_.get_capacity() / 2;
+
+	for (size_t written = 0; written < byteCount; written += pieceBytes)
+	{
+		const size_t count = byteCount - written < pieceBytes ? byteCount - written : pieceBytes;
+
+		size_t stagingOffset;
+		std::memcpy(mStaging_.allocate(count, &stagingOffset), source + written, count);
+
+		// ordered after every draw already issued, so the frames still drawing the old contents are never disturbed 
+		glCopyNamedBufferSubData(mStaging_.get_buffer(), buffer, stagingOffset, byteOffset + written, count);
+	}
+
+	mStaging_.fence();
+}
+
+void GraphMesh::write_grid_vertices(const Graph& mesh, size_t firstVertex, const std::vector<GraphVertex>& vertices)
+{
+	const size_t pieceVertices = mStaging_.get_capacity() / 2 / sizeof(unsigned int);
+	const size_t arenaVertex = mesh.gridVertices.offset + firstVertex;
+
+	for (size_t written = 0; written < vertices.size(); written += pieceVertices)
+	{
+		const size_t count = vertices.size() - written < pieceVertices ? vertices.size() - written : pieceVertices;
+
+		// packed straight into the mapped memory, so a grid is never held in its packed form anywhere else 
+		size_t stagingOffset;
+		unsigned int* packedVertices = (unsigned int*)mStaging_.allocate(sizeof(unsigned int) * count, &stagingOffset);
+
+		for (size_t i = 0; i < count; i++)
+		{
+			packedVertices[i] = pack_grid_vertex(vertices[written + i], mesh.layout.heightOffset, mesh.layout.heightScale);
+		}
+
+		glCopyNamedBufferSubData(mStaging_.get_buffer(), mGridVertices_.buffer, stagingOffset, sizeof(unsigned int) * (arenaVertex + written), sizeof(unsigned int) * count);
+	}
+
+	mStaging_.fence();
+}
+
+void GraphMesh::rescale_grid(Graph* mesh, size_t vertexCount, float heightScale)
+{
+	// The rows already uploaded are not kept anywhere else, so they are read back, which waits for the GPU to finish copying them. This
+	// only happens when a streamed grid outgrows its scale, and the headroom it is given makes that rare 
+	std::vector<unsigned int> packedVertices(vertexCount);
+	glGetNamedBufferSubData(mGridVertices_.buffer, sizeof(unsigned int) * mesh->gridVertices.offset, sizeof(unsigned int) * vertexCount, packedVertices.data());
+
+	const float ratio = mesh->layout.heightScale / heightScale; // both are powers of two, so only heights pushed down into the subnormals lose any bits 
+	for (unsigned int& packedVertex : packedVertices)
+	{
+		const float height = glm::unpackHalf1x16((unsigned short)(packedVertex & 0xffff)) * ratio;
+		packedVertex = glm::packHalf1x16(height) | (packedVertex & 0xffff0000); // the normal is kept as it is 
+	}
+
+	mesh->layout.heightScale = heightScale;
+	write(mGridVertices_.buffer, sizeof(unsigned int) * mesh->gridVertices.offset, packedVertices.data(), sizeof(unsigned int) * vertexCount);
+}
+
+void GraphMesh::set_grid(Graph* mesh, const GridWindow& window, float heightOffset, float heightScale)
+{
+	mesh->isGrid = true;
+	mesh->layout = { window.sampleSize, window.firstRow, window.firstColumn, window.spacing, heightOffset, heightScale, { 0.f, 0.f } };
+
+	// The indices are in the arena once for each resolution, every graph at this resolution draws the same ones 
+	reserve_grid_indices(window.sampleSize);
+}
+
+void GraphMesh::reserve_grid_indices(int sampleSize)
+{
+	Range& range = mGridIndices_[sampleSize]; // a new grid starts with nothing reserved
+	if (range.capacity != 0) return;
+
+	const size_t indexCount = GraphLogic::get_grid_index_count(sampleSize);
+
+	reserve(&mIndices_, &range, indexCount);
+	write(mIndices_.buffer, sizeof(unsigned int) * range.offset, GraphLogic::get_grid_indices(sampleSize), sizeof(unsigned int) * indexCount);
+	GraphLogic::release_grid_indices(sampleSize); // copied into the staging ring, so the generated indices are not needed again 
+}
+
+void GraphMesh::reserve(Arena* arena, Range* range, size_t count)
+{
+	if (count <= range->capacity) return; // the existing range is reused
+
+	range->capacity = 0; // the range is replaced, so its old contents are not worth keeping
+	if (arena->capacity - arena->end < count) repack(arena, count);
+
+	range->offset = arena->end;
+	range->capacity = count;
+	arena->end += count;
+}
+
+void GraphMesh::repack(Arena* arena, size_t extraCount)
+{
+	const std::vector<Range*> liveRanges = collect_live_ranges(arena);
+
+	size_t capacity = extraCount;
+	for (const Range* range : liveRanges) capacity += range->capacity;
+	capacity += capacity / 4; // room for graphs to grow before the arena has to be reallocated again
+	if (capacity < arena->capacity) capacity = arena->capacity; // never shrinks, so switching back and forth between meshes settles on one size
+
+	unsigned int buffer;
+	glCreateBuffers(1, &buffer);
+	glNamedBufferStorage(buffer, arena->elementSize * capacity, nullptr, 0); // immutable, it is only written by copies on the GPU
+
+	// every range that is still in use is copied on the GPU, and the gaps left by ranges that moved or were forgotten are closed 
+	size_t end = 0;
+	for (Range* range : liveRanges)
+	{
+		glCopyNamedBufferSubData(arena->buffer, buffer, arena->elementSize * range->offset, arena->elementSize * end, arena->elementSize * range->capacity);
+		range->offset = end;
+		end += range->capacity;
+	}
+
+	if (arena->buffer != 0)
+	{
+		glDeleteBuffers(1, &arena->buffer);
+		mLiveBufferBytes_ -= (long long)(arena->elementSize * arena->capacity);
+	}
+	mLiveBufferBytes_ += (long long)(arena->elementSize * capacity);
+
+	arena->buffer = buffer;
+	arena->capacity = capacity;
+	arena->end = end;
+
+	if (arena == &mIndices_)
+	{
+		glVertexArrayElementBuffer(mGridVao_, buffer);
+		glVertexArrayElementBuffer(mMeshVao_, buffer);
+	}
+	else
+	{
+		glVertexArrayVertexBuffer(arena == &mGridVertices_ ? mGridVao_ : mMeshVao_, 0, buffer, 0, (GLsizei)arena->elementSize);
+	}
+}
+
+std::vector<GraphMesh::Range*> GraphMesh::collect_live_ranges(const Arena* arena)
+{
+	std::vector<Range*> liveRanges;
+
+	// a graph's vertices and its own indices are only kept while it has the kind of mesh that uses them 
+	for (Graph& mesh : mGraphs_)
+	{
+		if (mesh.isGrid)
+		{
+			mesh.meshVertices.capacity = 0;
+			mesh.indices.capacity = 0;
+		}
+		else
+		{
+			mesh.gridVertices.capacity = 0;
+		}
+
+		Range* range = arena == &mGridVertices_ ? &mesh.gridVertices : (arena == &mMeshVertices_ ? &mesh.meshVertices : &mesh.indices);
+		if (range->capacity != 0) liveRanges.push_back(range);
+	}
+
+	if (arena != &mIndices_) return liveRanges;
+
+	// and a grid's indices only while a graph is drawn with them 
+	for (std::map<int, Range>::iterator grid = mGridIndices_.begin(); grid != mGridIndices_.end();)
+	{
+		bool isUsed = false;
+		for (const Graph& mesh : mGraphs_) isUsed = isUsed || (mesh.isGrid && mesh.layout.sampleSize == grid->first);
+
+		if (!isUsed)
+		{
+			grid = mGridIndices_.erase(grid);
+			continue;
+		}
+
+		if (grid->second.capacity != 0) liveRanges.push_back(&grid->second);
+		++grid;
+	}
+
+	return liveRanges;
+}
+
+void GraphMesh::draw(const ShaderProgram& gridProgram, const ShaderProgram& meshProgram)
+{
+	if (mCommandsChanged_) // the commands only change when a graph is uploaded, so most frames upload nothing 
+	{
+		mCommands_.clear();
+
+		// every graph's indices count from its own first vertex, so grids can share indices wherever their vertices are in the arena 
+		for (unsigned int i = 0; i < mGraphs_.size(); i++)
+		{
+			const Graph& mesh = mGraphs_[i];
+			if (mesh.indexCount == 0 || !mesh.isGrid) continue; // a graph without a mesh is not drawn at all 
+
+			const Range& indices = mGridIndices_.at(mesh.layout.sampleSize);
+			mCommands_.push_back({ mesh.indexCount, 1, (unsigned int)indices.offset, (int)mesh.gridVertices.offset, i });
+			mLayouts_[i] = mesh.layout;
+		}
+		mGridCommandCount_ = mCommands_.size();
+
+		for (unsigned int i = 0; i < mGraphs_.size(); i++)
+		{
+			const Graph& mesh = mGraphs_[i];
+			if (mesh.indexCount == 0 || mesh.isGrid) continue;
+
+			mCommands_.push_back({ mesh.indexCount, 1, (unsigned int)mesh.indices.offset, (int)mesh.meshVertices.offset, i });
+		}
+
+		if (!mCommands_.empty()) glNamedBufferSubData(mCommandBuffer_, 0, sizeof(DrawCommand) * mCommands_.size(), mCommands_.data());
+		if (mGridCommandCount_ != 0) glNamedBufferSubData(mLayoutBuffer_, 0, sizeof(GridLayout) * mLayouts_.size(), mLayouts_.data());
+		mCommandsChanged_ = false;
+	}
+
+	if (mCommands_.empty()) return;
+
+	// the shaders read each graph's index from gl_BaseInstance 
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mCommandBuffer_);
+
+	if (mGridCommandCount_ != 0)
+	{
+		gridProgram.use();
+		glBindVertexArray(mGridVao_);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, (GLsizei)mGridCommandCount_, 0);
+	}
+
+	if (mCommands_.size() != mGridCommandCount_)
+	{
+		meshProgram.use();
+		glBindVertexArray(mMeshVao_);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)(sizeof(DrawCommand) * mGridCommandCount_), (GLsizei)(mCommands_.size() - mGridCommandCount_), 0);
+	}
+}
+
+void GraphMesh::release()
+{
+	for (Arena* arena : { &mGridVertices_, &mMeshVertices_, &mIndices_ })
+	{
+		if (arena->buffer != 0)
+		{
+			glDeleteBuffers(1, &arena->buffer);
+			mLiveBufferBytes_ -= (long long)(arena->elementSize * arena->capacity);
+		}
+
+		arena->buffer = 0;
+		arena->capacity = 0;
+		arena->end = 0;
+	}
+	if (mCommandBuffer_ != 0)
+	{
+		glDeleteBuffers(1, &mCommandBuffer_);
+		mLiveBufferBytes_ -= (long long)(sizeof(DrawCommand) * mGraphs_.size());
+	}
+	if (mLayoutBuffer_ != 0)
+	{
+		glDeleteBuffers(1, &mLayoutBuffer_);
+		mLiveBufferBytes_ -= (long long)(sizeof(GridLayout) * mLayouts_.size());
+	}
+	if (mStaging_.get_buffer() != 0)
+	{
+		mLiveBufferBytes_ -= (long long)mStaging_.get_capacity();
+		mStaging_.release();
+	}
+	if (mGridVao_ != 0)
+	{
+		glDeleteVertexArrays(1, &mGridVao_);
+		glDeleteVertexArrays(1, &mMeshVao_);
+	}
+
+	mGridVao_ = 0;
+	mMeshVao_ = 0;
+	mCommandBuffer_ = 0;
+	mLayoutBuffer_ = 0;
+	mCommands_.clear();
+	mGridCommandCount_ = 0;
+	mCommandsChanged_ = false;
+	mGridIndices_.clear();
+
+	for (Graph& mesh : mGraphs_)
+	{
+		mesh = Graph();
+	}
+}
+
+bool GraphMesh::has_mesh(int graph) const
+{
+	return mGraphs_[graph].indexCount != 0;
+}
+
+unsigned int GraphMesh::get_index_count(int graph) const
+{
+	return mGraphs_[graph].indexCount;
+}
+
+unsigned int GraphMesh::get_grid_index_buffer(int sampleSize)
+{
+	std::map<int, unsigned int>::iterator existingBuffer = mGridIndexBuffers_.find(sampleSize);
+	if (existingBuffer != mGridIndexBuffers_.end()) return existingBuffer->second;
+
+	const size_t byteCount = sizeof(unsigned int) * GraphLogic::get_grid_index_count(sampleSize);
+
+	unsigned int ebo; // ebo = element buffer object
+	glGenBuffers(1, &ebo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+	glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, byteCount, GraphLogic::get_grid_indices(sampleSize), 0); // immutable, the indices never change 
+	GraphLogic::release_grid_indices(sampleSize); // glBufferStorage has copied them 
+
+	mLiveBufferBytes_ += (long long)byteCount;
+
+	mGridIndexBuffers_[sampleSize] = ebo;
+	return ebo;
+}
+
+void GraphMesh::release_unused_shared_buffers(const std::vector<int>& drawnSampleSizes)
+{
+	// dragging a resolution slider passes through many sizes, and each would otherwise be kept until the program exits 
+	for (std::map<int, unsigned int>::iterator indexBuffer = mGridIndexBuffers_.begin(); indexBuffer != mGridIndexBuffers_.end();)
+	{
+		if (std::find(drawnSampleSizes.begin(), drawnSampleSizes.end(), indexBuffer->first) != drawnSampleSizes.end())
+		{
+			++indexBuffer;
+			continue;
+		}
+
+		glDeleteBuffers(1, &indexBuffer->second); // the GL keeps the storage until the draws already issued with it are done 
+		mLiveBufferBytes_ -= (long long)(sizeof(unsigned int) * GraphLogic::get_grid_index_count(indexBuffer->first));
+		indexBuffer = mGridIndexBuffers_.erase(indexBuffer);
+	}
+}
+
+void GraphMesh::release_shared_buffers()
+{
+	for (const std::pair<const int, unsigned int>& indexBuffer : mGridIndexBuffers_)
+	{
+		glDeleteBuffers(1, &indexBuffer.second);
+		mLiveBufferBytes_ -= (long long)(sizeof(unsigned int) * GraphLogic::get_grid_index_count(indexBuffer.first));
+	}
+	mGridIndexBuffers_.clear();
+}
+
+long long GraphMesh::get_live_buffer_bytes()
+{
+	return mLiveBufferBytes_;
+}
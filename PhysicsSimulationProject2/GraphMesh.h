@@ -0,0 +1,154 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <cstddef>
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+#include "GraphLogic.h"
+#include "StreamingBuffer.h"
+#include "ShaderProgram.h"
+
+/**
+ * \brief The GPU side of every sampled graph. All graphs are packed into one arena, a vertex buffer for each kind of mesh and one
+ * index buffer, in which every graph owns a range that is reused for every edit and only moved when a mesh does not fit in it. Graphs
+ * without a mesh are skipped, and the rest are drawn with one indirect multi-draw for each kind of mesh, so drawing costs the same two
+ * calls however many graphs there are.
+ * A grid mesh's x and y are implied by its GridWindow, so each of its vertices only stores the height and the normal, packed into 32 bits
+ * instead of 24 bytes, and grid_vertex_shader.txt finds x and y from the vertex's index. Meshes with their own indices, from the
+ * AdaptiveSampler and the LodSampler, are not on a grid and keep whole GraphVertex values, drawn with vertex_shader.txt. Meshes are written into a persistently mapped StreamingBuffer and copied into the arena on the GPU, so an edit
+ * never reallocates a buffer or waits for the frames still drawing the old mesh. Every buffer holding graph geometry, and the command,
+ * layout and staging buffers that go with it, is allocated by this class, so that the number of bytes they take up can be reported. The
+ * uniform buffer of the Scene block is ShaderProgram's and is not counted
+ */
+class GraphMesh
+{
+public:
+	static const unsigned int gridBinding = 1; // the uniform buffer binding of the Grids block in grid_vertex_shader.txt
+
+	explicit GraphMesh(int graphCount); // graphCount must be the length of the arrays in the shaders' uniform blocks
+	~GraphMesh();
+	GraphMesh(const GraphMesh&) = delete;
+	GraphMesh(GraphMesh&&) = delete;
+	GraphMesh& operator=(const GraphMesh&) = delete;
+	GraphMesh& operator=(GraphMesh&&) = delete;
+
+	/**
+	 * \brief Replaces a graph's mesh, requires an OpenGL context
+	 * \param graph - the graph's index, which is also its index in the Scene block, see SceneUniforms
+	 * \param vertices - the sampled points, an empty vector clears the graph
+	 * \param window - the points that were sampled, the positions of the vertices are not uploaded and must be the ones the window gives
+	 */
+	void upload(int graph, const std::vector<GraphVertex>& vertices, const GridWindow& window);
+
+	// Replaces a graph's mesh with one that has its own indices, such as a mesh from the AdaptiveSampler
+	void upload(int graph, const std::vector<GraphVertex>& vertices, const std::vector<unsigned int>& indices);
+
+	/**
+	 * \brief Uploads some of the rows of a grid that is streamed in chunks, the rows that have arrived so far are drawn while the rest are still being sampled
+	 * \param vertices - whole rows of the grid, which must arrive in order
+	 * \param window - the whole grid being streamed
+	 * \param firstRow - the grid row of the first vertex, 0 replaces the mesh with the new grid
+	 */
+	void upload_rows(int graph, const std::vector<GraphVertex>& vertices, const GridWindow& window, int firstRow);
+
+	/**
+	 * \brief Draws every graph that has a mesh with one call for each kind of mesh, each graph as the instance with its index so that the
+	 * shaders pick its model matrix and colour from gl_BaseInstance. Leaves whichever program was used last bound
+	 * \param gridProgram - linked from grid_vertex_shader.txt
+	 * \param meshProgram - linked from vertex_shader.txt
+	 */
+	void draw(const ShaderProgram& gridProgram, const ShaderProgram& meshProgram);
+	void release(); // frees every GL object owned by the arena, must be called before the context is destroyed
+
+	bool has_mesh(int graph) const;
+	unsigned int get_index_count(int graph) const;
+
+	static unsigned int get_grid_index_buffer(int sampleSize); // one immutable element buffer per resolution, for graphs drawn by a SurfaceShader
+	static void release_unused_shared_buffers(const std::vector<int>& drawnSampleSizes); // frees the shared index buffers of every other resolution
+	static void release_shared_buffers(); // frees the index buffers shared by every SurfaceShader
+	static long long get_live_buffer_bytes(); // the number of bytes in this class's GL buffers that have not been freed yet
+
+private:
+	// A part of one of the arena's buffers, counted in vertices or indices
+	struct Range
+	{
+		size_t offset;
+		size_t capacity; // a graph that shrinks keeps its whole range, 0 if nothing is reserved
+	};
+
+	// One of the arena's buffers. Ranges are taken from the free space at its end, and the buffer is only reallocated, with every range
+	// still in use packed together, once that space runs out
+	struct Arena
+	{
+		unsigned int buffer;
+		size_t capacity;
+		size_t end; // where the free space starts
+		size_t elementSize;
+	};
+
+	// Where a grid mesh's vertices are, laid out as GridLayout is in the Grids block, std140
+	struct GridLayout
+	{
+		int sampleSize; // also decides which grid's indices the mesh uses
+		int firstRow;
+		int firstColumn;
+		float spacing;
+		float heightOffset; // added to every height, so that a half float only has to hold the distance from the middle of the graph
+		float heightScale; // a power of two every stored height is multiplied by, so that distances past a half float's 65504 still fit
+		float padding[2];
+	};
+
+	struct Graph
+	{
+		bool isGrid; // a grid mesh, otherwise a mesh with its own indices
+		GridLayout layout; // only used by a grid mesh
+		Range gridVertices; // the packed vertices of a grid mesh
+		Range meshVertices; // the vertices of a mesh with its own indices
+		Range indices; // only used by a mesh with its own indices
+		unsigned int indexCount; // 0 if the graph has no mesh
+	};
+
+	// The layout glMultiDrawElementsIndirect reads its draws in
+	struct DrawCommand
+	{
+		unsigned int count;
+		unsigned int instanceCount;
+		unsigned int firstIndex;
+		int baseVertex;
+		unsigned int baseInstance;
+	};
+
+	void create_objects(); // creates the vertex arrays, the command and layout buffers and the staging ring on first use, the arenas are allocated by their first range
+	void write(unsigned int buffer, size_t byteOffset, const void* data, size_t byteCount); // copies the data into the buffer through the staging ring
+	void write_grid_vertices(const Graph& mesh, size_t firstVertex, const std::vector<GraphVertex>& vertices); // packs the vertices straight into the staging ring
+	void set_grid(Graph* mesh, const GridWindow& window, float heightOffset, float heightScale); // makes the graph a grid mesh, its vertices still need to be reserved
+	void rescale_grid(Graph* mesh, size_t vertexCount, float heightScale); // repacks the grid's first vertices with a larger scale, for a streamed grid that outgrew its first chunk
+	void reserve_grid_indices(int sampleSize); // uploads the grid's indices into the arena unless another graph already uses them
+
+	// moves the range to the free space if the count does not fit in it, reallocating the arena if that has not got room either. The
+	// range's previous contents are lost if it has to move
+	void reserve(Arena* arena, Range* range, size_t count);
+	void repack(Arena* arena, size_t extraCount);
+	std::vector<Range*> collect_live_ranges(const Arena* arena); // the ranges that are kept when the arena is reallocated, forgets every other range
+
+	unsigned int mGridVao_; // reads packed grid vertices
+	unsigned int mMeshVao_; // reads whole GraphVertex values
+	StreamingBuffer mStaging_; // every upload passes through here, the arenas themselves are only ever written by the GPU
+	Arena mGridVertices_;
+	Arena mMeshVertices_;
+	Arena mIndices_; // shared by both vertex arrays
+	std::map<int, Range> mGridIndices_; // the indices of every grid resolution a graph is drawn with, shared by the graphs at that resolution
+	std::vector<Graph> mGraphs_;
+
+	unsigned int mCommandBuffer_; // one command per graph, the grids' first, rewritten only when a graph's range or index count has changed
+	std::vector<DrawCommand> mCommands_;
+	size_t mGridCommandCount_;
+	unsigned int mLayoutBuffer_; // the Grids block, rewritten along with the commands
+	std::vector<GridLayout> mLayouts_;
+	bool mCommandsChanged_;
+
+	static std::map<int, unsigned int> mGridIndexBuffers_;
+	static long long mLiveBufferBytes_;
+};
@@ -0,0 +1,385 @@
+#include "GraphRebuilder.h"
+#include <cassert>
+
+#include "InputHandler.h"
+#include "GraphLogic.h"
+#include "AdaptiveSampler.h"
+#include "LodSampler.h"
+#include "ExpressionOptimiser.h"
+
+GraphRebuilder::GraphRebuilder() :
+	mStreamedBytes_(0),
+	mRunningSlots_(0),
+	mIsShuttingDown_(false),
+	mCancelRunning_(false)
+{
+	for (Request& request : mRequests_)
+	{
+		request.isPending = false;
+		request.sampleSize = 0;
+		request.mode = SamplingMode::Grid;
+		request.domain = { 0.f, 0.f, 0 };
+		request.view = { glm::mat4(1.f), glm::mat4(1.f), glm::mat4(1.f), 1.f };
+	}
+	mRunningRequests_ = mRequests_;
+
+	mWorker_ = std::thread(&GraphRebuilder::worker_loop, this); // started last, once every member has been initialised
+}
+
+GraphRebuilder::~GraphRebuilder()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex_);
+		mIsShuttingDown_ = true;
+		mCancelRunning_ = true; // there is no point finishing a graph that will never be drawn
+	}
+	mRequestAvailable_.notify_one();
+	mChunksTaken_.notify_one();
+
+	mWorker_.join();
+}
+
+void GraphRebuilder::request_rebuild(unsigned int slot, const std::string& userInput, int sampleSize, SamplingMode mode, const GraphDomain& domain, const LodView& view)
+{
+	assert(slot < slotCount);
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex_);
+
+		// overwriting the request means an older request that has not started yet is simply dropped
+		mRequests_[slot].isPending = true;
+		mRequests_[slot].userInput = userInput;
+		mRequests_[slot].sampleSize = GraphLogic::clamp_sample_size(sampleSize); // a bad resolution would stop the worker, not just this graph
+		mRequests_[slot].mode = mode;
+		mRequests_[slot].domain = domain;
+		mRequests_[slot].view = view;
+
+		// The mesh being sampled is already out of date. A grid whose domain moved is left to finish, as the next rebuild reuses its samples,
+		// and so is a view dependent graph whose view moved, as cancelling it on every frame the camera moves would never produce a mesh
+		const Request& running = mRunningRequests_[slot];
+		const bool isOnlyMoved = mode != SamplingMode::Adaptive && running.mode == mode && running.userInput == userInput && running.sampleSize == mRequests_[slot].sampleSize;
+
+		if ((mRunningSlots_ & (1u << slot)) && !isOnlyMoved) mCancelRunning_ = true;
+	}
+	mRequestAvailable_.notify_one();
+	mChunksTaken_.notify_one(); // a stream that was cancelled stops waiting for memory
+}
+
+std::vector<GraphMeshData> GraphRebuilder::take_finished_meshes()
+{
+	std::lock_guard<std::mutex> lock(mMutex_);
+
+	std::vector<GraphMeshData> finishedMeshes(std::make_move_iterator(mFinishedMeshes_.begin()), std::make_move_iterator(mFinishedMeshes_.end()));
+	mFinishedMeshes_.clear();
+
+	mStreamedBytes_ = 0;
+	mChunksTaken_.notify_one();
+
+	return finishedMeshes;
+}
+
+void GraphRebuilder::worker_loop()
+{
+	while (true)
+	{
+		std::vector<Job> jobs;
+
+		{
+			std::unique_lock<std::mutex> lock(mMutex_);
+
+			auto has_pending = [this]()
+			{
+				for (const Request& request : mRequests_)
+				{
+					if (request.isPending) return true;
+				}
+				return false;
+			};
+
+			mRequestAvailable_.wait(lock, [&]() { return mIsShuttingDown_ || has_pending(); });
+
+			if (mIsShuttingDown_) return;
+
+			jobs = take_jobs();
+
+			mRunningSlots_ = 0;
+			for (const Job& job : jobs)
+			{
+				mRunningSlots_ |= 1u << job.slot;
+				mRunningRequests_[job.slot] = job.request;
+			}
+			mCancelRunning_ = false;
+		}
+
+		std::vector<GraphMeshData> meshes;
+		build_meshes(jobs, meshes);
+
+		std::lock_guard<std::mutex> lock(mMutex_);
+
+		if (!mCancelRunning_)
+		{
+			for (GraphMeshData& mesh : meshes) mFinishedMeshes_.push_back(std::move(mesh));
+		}
+		else if (!mIsShuttingDown_)
+		{
+			// Only one of the graphs was superseded, the others were cancelled with it and are sampled again unless they have been replaced too
+			for (Job& job : jobs)
+			{
+				mCaches_[job.slot].evaluator.reset(); // the samples may have been only partly updated
+				mCaches_[job.slot].samples.invalidate();
+
+				if (mRequests_[job.slot].isPending) continue;
+
+				mRequests_[job.slot] = std::move(job.request);
+				mRequests_[job.slot].isPending = true;
+			}
+		}
+		mRunningSlots_ = 0;
+	}
+}
+
+std::vector<GraphRebuilder::Job> GraphRebuilder::take_jobs()
+{
+	std::vector<Job> jobs;
+
+	for (unsigned int slot = 0; slot < slotCount; slot++)
+	{
+		const Request& request = mRequests_[slot];
+		if (!request.isPending) continue;
+
+		// Adaptive graphs are sampled one at a time, grid graphs are sampled together if they share the same grid.
+		// View dependent graphs are all taken together, as the camera moving requests every one again and the first would otherwise be taken every time
+		if (!jobs.empty())
+		{
+			const Request& first = jobs[0].request;
+			const bool isSameDomain = request.domain.centreX == first.domain.centreX && request.domain.centreY == first.domain.centreY && request.domain.zoomLevel == first.domain.zoomLevel;
+			const bool isSameGrid = request.mode == SamplingMode::Grid && request.sampleSize == first.sampleSize && isSameDomain;
+
+			if (request.mode != first.mode || request.mode == SamplingMode::Adaptive || (request.mode == SamplingMode::Grid && !isSameGrid)) continue;
+		}
+
+		Job job;
+		job.slot = slot;
+		job.request = std::move(mRequests_[slot]);
+		job.errorFlag = false;
+		mRequests_[slot].isPending = false;
+
+		jobs.push_back(std::move(job));
+	}
+
+	return jobs;
+}
+
+void GraphRebuilder::build_meshes(std::vector<Job>& jobs, std::vector<GraphMeshData>& meshes)
+{
+	std::vector<Job*> groupedJobs; // grid graphs that will be interpreted, so they gain from being merged
+	std::vector<ExpressionProgram> groupedPrograms;
+
+	for (Job& job : jobs)
+	{
+		SlotCache& cache = mCaches_[job.slot];
+
+		if (job.request.mode == SamplingMode::Grid)
+		{
+			job.window = GraphLogic::get_grid_window(job.request.domain, job.request.sampleSize);
+
+			// Only the domain has moved since the graph was last sampled, so only the points that were not already sampled are evaluated
+			if (cache.evaluator != nullptr && cache.userInput == job.request.userInput && cache.samples.can_reuse(job.window))
+			{
+				GraphLogic::sample_spans(*cache.evaluator, job.window.spacing, cache.samples.move_to(job.window), &mCancelRunning_);
+
+				GraphMeshData mesh;
+				mesh.slot = job.slot;
+				mesh.sampleSize = job.request.sampleSize;
+				mesh.window = job.window;
+				mesh.vertices = cache.samples.get_vertices();
+
+				meshes.push_back(std::move(mesh));
+				continue;
+			}
+		}
+
+		// Only the view or the domain has moved since the graph was last sampled, so the expression does not need compiling again
+		if (job.request.mode == SamplingMode::ViewDependent && cache.evaluator != nullptr && cache.userInput == job.request.userInput)
+		{
+			AdaptiveMesh lodMesh = LodSampler::sample(*cache.evaluator, job.request.sampleSize, job.request.domain, job.request.view, &mCancelRunning_);
+
+			GraphMeshData mesh;
+			mesh.slot = job.slot;
+			mesh.sampleSize = job.request.sampleSize;
+			mesh.vertices = std::move(lodMesh.vertices);
+			mesh.indices = std::move(lodMesh.indices);
+
+			meshes.push_back(std::move(mesh));
+			continue;
+		}
+
+		// the samples are replaced by the new graph's once it has been sampled on a grid
+		cache.evaluator.reset();
+		cache.samples.invalidate();
+
+		InputHandler::verify_and_convert_function(job.request.userInput, &mPostfixExpression_, &job.errorFlag);
+
+		// The postfix expression is compiled once here, instead of being re-parsed for every sample 
+		ExpressionProgram program = job.errorFlag ? ExpressionProgram() : ExpressionProgram::compile(mPostfixExpression_, &job.errorFlag);
+
+		if (job.errorFlag) continue; // The mesh should not be replaced if the graph provided by the user is INVALID
+
+		// The adaptive sampler visits points in no particular order, so only grid sampling gains from hoisting work out of each row 
+		job.program = ExpressionOptimiser::optimise(program, job.request.mode != SamplingMode::Adaptive);
+		job.evaluator = std::make_unique<ExpressionJit>(job.program); // uses native code where the platform supports it, otherwise the interpreter 
+
+		if (job.request.mode == SamplingMode::Adaptive)
+		{
+			AdaptiveMesh adaptiveMesh = AdaptiveSampler::sample(*job.evaluator, AdaptiveSampler::defaultTolerance, job.request.domain, &mCancelRunning_);
+
+			GraphMeshData mesh;
+			mesh.slot = job.slot;
+			mesh.sampleSize = job.request.sampleSize;
+			mesh.vertices = std::move(adaptiveMesh.vertices);
+			mesh.indices = std::move(adaptiveMesh.indices);
+
+			meshes.push_back(std::move(mesh));
+			continue;
+		}
+
+		if (job.request.mode == SamplingMode::ViewDependent)
+		{
+			AdaptiveMesh lodMesh = LodSampler::sample(*job.evaluator, job.request.sampleSize, job.request.domain, job.request.view, &mCancelRunning_);
+
+			if (!job.program.is_empty()) // kept so that moving the camera only resamples the graph
+			{
+				cache.userInput = job.request.userInput;
+				cache.evaluator = std::move(job.evaluator);
+			}
+
+			GraphMeshData mesh;
+			mesh.slot = job.slot;
+			mesh.sampleSize = job.request.sampleSize;
+			mesh.vertices = std::move(lodMesh.vertices);
+			mesh.indices = std::move(lodMesh.indices);
+
+			meshes.push_back(std::move(mesh));
+			continue;
+		}
+
+		// Sums and products of terms in only x or only y are evaluated once per row and column, which beats any per point evaluator
+		SeparableProgram separable;
+		const bool isSeparable = ExpressionOptimiser::separate(program, &separable);
+
+		// A whole grid this large would hold a lot of memory and take a while to appear, so it is handed over a chunk at a time instead
+		if (!job.program.is_empty() && job.request.sampleSize >= minStreamedSampleSize)
+		{
+			stream_grid_job(job, isSeparable ? &separable : nullptr);
+			continue;
+		}
+
+		if (isSeparable)
+		{
+			finish_grid_job(job, GraphLogic::sample_points(separable, job.window, &mCancelRunning_), meshes);
+			continue;
+		}
+
+		// Native code keeps every value in registers, which is faster than any interpreter even when the work is shared
+		if (!job.program.is_empty() && !job.evaluator->is_gradient_compiled())
+		{
+			groupedJobs.push_back(&job);
+			groupedPrograms.push_back(ExpressionOptimiser::optimise(program, false)); // the group hoists row invariant work itself
+			continue;
+		}
+
+		finish_grid_job(job, GraphLogic::sample_points(*job.evaluator, job.window, &mCancelRunning_), meshes);
+	}
+
+	if (groupedJobs.empty()) return;
+
+	std::vector<std::vector<GraphVertex>> groupedVertices;
+
+	if (groupedJobs.size() > 1)
+	{
+		ExpressionGroup group(groupedPrograms);
+		if (group.is_valid()) groupedVertices = GraphLogic::sample_points(group, groupedJobs[0]->window, &mCancelRunning_);
+	}
+
+	if (groupedVertices.empty() && !mCancelRunning_) // a single graph has nothing to share, and a group too large to evaluate is sampled one graph at a time
+	{
+		for (Job* job : groupedJobs)
+		{
+			groupedVertices.push_back(GraphLogic::sample_points(*job->evaluator, job->window, &mCancelRunning_));
+		}
+	}
+
+	if (groupedVertices.size() != groupedJobs.size()) return; // cancelled
+
+	for (size_t i = 0; i < groupedJobs.size(); i++)
+	{
+		finish_grid_job(*groupedJobs[i], std::move(groupedVertices[i]), meshes);
+	}
+}
+
+void GraphRebuilder::finish_grid_job(Job& job, std::vector<GraphVertex> vertices, std::vector<GraphMeshData>& meshes)
+{
+	const int sampleSize = job.request.sampleSize;
+
+	// an empty graph has nothing worth keeping, and a cancelled one is missing samples
+	if (!job.program.is_empty() && vertices.size() == (size_t)sampleSize * sampleSize)
+	{
+		SlotCache& cache = mCaches_[job.slot];
+		cache.userInput = job.request.userInput;
+		cache.evaluator = std::move(job.evaluator);
+		cache.samples.store(job.window, vertices);
+	}
+
+	GraphMeshData mesh;
+	mesh.slot = job.slot;
+	mesh.sampleSize = sampleSize;
+	mesh.window = job.window;
+	mesh.vertices = std::move(vertices);
+
+	meshes.push_back(std::move(mesh));
+}
+
+void GraphRebuilder::stream_grid_job(Job& job, const SeparableProgram* separable)
+{
+	const int sampleSize = job.request.sampleSize;
+
+	for (int firstRow = 0; firstRow < sampleSize; firstRow += streamedRowsPerChunk)
+	{
+		const int rowCount = sampleSize - firstRow < streamedRowsPerChunk ? sampleSize - firstRow : streamedRowsPerChunk;
+
+		GraphMeshData chunk;
+		chunk.slot = job.slot;
+		chunk.sampleSize = sampleSize;
+		chunk.window = job.window;
+		chunk.firstRow = firstRow;
+		chunk.vertices.resize((size_t)rowCount * sampleSize);
+
+		if (separable != nullptr)
+		{
+			GraphLogic::sample_rows(*separable, job.window, firstRow, rowCount, chunk.vertices.data(), &mCancelRunning_);
+		}
+		else
+		{
+			// every row of the chunk is one span, which writes straight into the chunk
+			std::vector<GridSpan> spans;
+			for (int row = 0; row < rowCount; row++)
+			{
+				spans.push_back({ job.window.firstRow + firstRow + row, job.window.firstColumn, 1, sampleSize, &chunk.vertices[(size_t)row * sampleSize] });
+			}
+
+			GraphLogic::sample_spans(*job.evaluator, job.window.spacing, spans, &mCancelRunning_);
+		}
+
+		const size_t chunkBytes = sizeof(GraphVertex) * chunk.vertices.size();
+
+		std::unique_lock<std::mutex> lock(mMutex_);
+
+		// the chunks already waiting must be taken before another fits in the budget, one chunk is always let through so a stream can never stall
+		mChunksTaken_.wait(lock, [&]() { return mCancelRunning_ || mStreamedBytes_ == 0 || mStreamedBytes_ + chunkBytes <= streamBudgetBytes; });
+
+		if (mCancelRunning_) return; // the rest of the grid is no longer wanted, the worker requeues the job if it is still needed
+
+		mStreamedBytes_ += chunkBytes;
+		mFinishedMeshes_.push_back(std::move(chunk));
+	}
+}
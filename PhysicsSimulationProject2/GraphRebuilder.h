@@ -0,0 +1,129 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <array>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+#include "glm/glm.hpp"
+
+#include "GraphLogic.h"
+#include "GridSampleCache.h"
+#include "LodSampler.h"
+
+// How the points of a graph are chosen
+enum class SamplingMode
+{
+	Grid, // sampleSize points along each axis
+	Adaptive, // refined where the surface bends, see AdaptiveSampler
+	ViewDependent // refined where the graph is close to the camera, see LodSampler
+};
+
+// The CPU side of a graph's mesh, produced on the rebuild thread and uploaded to the GPU by the main thread
+struct GraphMeshData
+{
+	unsigned int slot; // which of the graphs this mesh belongs to
+	int sampleSize; // the number of samples along each axis that the mesh was built with
+	GridWindow window; // the points a grid mesh was sampled at, the GPU finds the vertices' x and y from it, see GraphMesh
+	int firstRow = -1; // -1 for a whole mesh, otherwise the vertices are whole rows of a grid streamed in chunks, starting at this row, see GraphMesh::upload_rows
+	std::vector<GraphVertex> vertices; // empty if the user cleared the graph
+	std::vector<unsigned int> indices; // only used by adaptive and view dependent meshes, grid meshes share their indices, see GraphLogic::get_grid_indices
+};
+
+/**
+ * \brief Parses and samples graphs on a background thread, so that typing into a text box never stalls the render loop.
+ * Only the newest request for each graph is kept: a request that has not started yet is replaced, and one that is
+ * already being sampled is cancelled. The main thread collects finished meshes with take_finished_meshes() and uploads them,
+ * so the previous mesh keeps being drawn until its replacement is ready.
+ * Grid graphs waiting at the same time are rebuilt together, and the ones that would be interpreted are merged into an ExpressionGroup
+ * so the work they share is only done once. The samples of every grid graph are kept, so when only the domain moves just the newly exposed points are sampled.
+ * Very large grids are instead streamed in chunks of rows, each handed over as soon as it is sampled so the graph is drawn as it fills in,
+ * and the rebuild thread waits whenever the chunks not yet taken would exceed streamBudgetBytes, so memory does not grow with the resolution
+ */
+class GraphRebuilder
+{
+public:
+	static const unsigned int slotCount = 10; // the number of graphs the user can enter
+	static const int minStreamedSampleSize = 512; // grids this large are streamed in chunks rather than built whole
+	static const int streamedRowsPerChunk = 64;
+	static const size_t streamBudgetBytes = 32 << 20; // the most memory held by chunks that the main thread has not taken yet
+
+	GraphRebuilder();
+	~GraphRebuilder();
+	GraphRebuilder(const GraphRebuilder&) = delete;
+	GraphRebuilder(GraphRebuilder&&) = delete;
+	GraphRebuilder& operator=(const GraphRebuilder&) = delete;
+	GraphRebuilder& operator=(GraphRebuilder&&) = delete;
+
+	/**
+	 * \brief Queues a rebuild of a graph, returns immediately
+	 * \param slot - the index of the graph being updated
+	 * \param userInput - given in infix form, this input has NOT been validated
+	 * \param sampleSize - the number of samples to take along each axis, ignored by adaptive sampling and the finest resolution of view dependent sampling
+	 * \param mode - how the points of the graph are chosen
+	 * \param domain - the part of the plane to sample. A grid graph that is already being sampled is not cancelled if only the domain changed,
+	 * as its samples can be reused by the next rebuild
+	 * \param view - where the graph is seen from, only used by view dependent sampling. A graph being sampled is left to finish if only
+	 * the view or the domain changed, so a mesh is still produced while the camera keeps moving
+	 */
+	void request_rebuild(unsigned int slot, const std::string& userInput, int sampleSize, SamplingMode mode, const GraphDomain& domain, const LodView& view);
+
+	std::vector<GraphMeshData> take_finished_meshes(); // returns every mesh and chunk finished since the last call in the order they finished, never blocks
+
+private:
+	struct Request
+	{
+		bool isPending;
+		std::string userInput;
+		int sampleSize;
+		SamplingMode mode;
+		GraphDomain domain;
+		LodView view;
+	};
+
+	struct Job
+	{
+		unsigned int slot;
+		Request request;
+		GridWindow window; // the points sampled, only used by grid graphs
+		ExpressionProgram program; // the optimised program, empty if the input was empty or invalid
+		std::unique_ptr<ExpressionJit> evaluator; // compiled from the program
+		bool errorFlag;
+	};
+
+	// What is kept of each grid or view dependent graph after it has been sampled, only used by the rebuild thread
+	struct SlotCache
+	{
+		std::string userInput; // the input the evaluator was compiled from
+		std::unique_ptr<ExpressionJit> evaluator; // fills in the points that are not cached, and resamples a view dependent graph, null if nothing is cached
+		GridSampleCache samples; // only valid for grid graphs
+	};
+
+	void worker_loop();
+	std::vector<Job> take_jobs(); // takes the first pending request, along with every other request that can be sampled alongside it. The mutex must be held
+	void build_meshes(std::vector<Job>& jobs, std::vector<GraphMeshData>& meshes); // appends a mesh for every job whose input was valid
+	void finish_grid_job(Job& job, std::vector<GraphVertex> vertices, std::vector<GraphMeshData>& meshes); // caches the samples and appends the mesh
+	// Samples the grid a chunk at a time, each chunk is finished as soon as it is sampled. A separable grid is sampled row by row from its parts.
+	// Streamed grids are not kept in the slot's GridSampleCache, as that would hold the whole grid, so moving the domain samples them again
+	void stream_grid_job(Job& job, const SeparableProgram* separable);
+
+	std::thread mWorker_;
+	std::mutex mMutex_;
+	std::condition_variable mRequestAvailable_;
+	std::condition_variable mChunksTaken_; // wakes a stream waiting for memory, when chunks are taken or the stream is cancelled
+
+	std::array<Request, slotCount> mRequests_; // the newest request that has not been started, for every graph
+	std::array<Request, slotCount> mRunningRequests_; // the request being sampled for every graph whose bit is set in mRunningSlots_
+	std::array<SlotCache, slotCount> mCaches_;
+	std::vector<Token> mPostfixExpression_; // reused by every parse on the rebuild thread, so parsing stops allocating once it has grown
+	std::deque<GraphMeshData> mFinishedMeshes_;
+	size_t mStreamedBytes_; // the memory held by the chunks in mFinishedMeshes_
+	unsigned int mRunningSlots_; // a bit for every graph currently being sampled
+	bool mIsShuttingDown_;
+
+	std::atomic<bool> mCancelRunning_; // set when any graph being sampled has been superseded by a newer request
+};
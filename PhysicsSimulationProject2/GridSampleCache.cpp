@@ -0,0 +1,226 @@
+#include "GridSampleCache.h"
+#include <cassert>
+#include <cstdlib>
+#include <algorithm>
+
+namespace
+{
+	int floor_divide(int a, int b) // rounds towards negative infinity, as lattice indices can be negative
+	{
+		return a / b - (a % b != 0 && (a < 0) != (b < 0));
+	}
+}
+
+GridSampleCache::GridSampleCache() :
+	mIsValid_(false),
+	mWindow_(),
+	mOriginRow_(0),
+	mOriginColumn_(0)
+{
+}
+
+bool GridSampleCache::is_valid() const
+{
+	return mIsValid_;
+}
+
+void GridSampleCache::invalidate()
+{
+	mIsValid_ = false;
+	std::vector<GraphVertex>().swap(mSamples_);
+}
+
+bool GridSampleCache::can_reuse(const GridWindow& window) const
+{
+	return mIsValid_ && window.sampleSize == mWindow_.sampleSize && std::abs(window.zoomLevel - mWindow_.zoomLevel) <= 1;
+}
+
+void GridSampleCache::store(const GridWindow& window, const std::vector<GraphVertex>& vertices)
+{
+	assert(vertices.size() == (size_t)window.sampleSize * window.sampleSize);
+
+	mIsValid_ = true;
+	mWindow_ = window;
+	mOriginRow_ = window.firstRow;
+	mOriginColumn_ = window.firstColumn;
+	mSamples_ = vertices;
+}
+
+std::vector<GridSpan> GridSampleCache::move_to(const GridWindow& window)
+{
+	if (can_reuse(window))
+	{
+		return window.zoomLevel == mWindow_.zoomLevel ? move_within_level(window) : move_across_level(window);
+	}
+
+	// nothing carries over, so the whole window is sampled
+	const int sampleSize = window.sampleSize;
+
+	mIsValid_ = true;
+	mWindow_ = window;
+	mOriginRow_ = window.firstRow;
+	mOriginColumn_ = window.firstColumn;
+	mSamples_.assign((size_t)sampleSize * sampleSize, GraphVertex());
+
+	std::vector<GridSpan> spans;
+	for (int row = window.firstRow; row < window.firstRow + sampleSize; row++)
+	{
+		add_spans(row, window.firstColumn, 1, sampleSize, spans);
+	}
+	return spans;
+}
+
+std::vector<GraphVertex> GridSampleCache::get_vertices() const
+{
+	assert(mIsValid_);
+
+	const int sampleSize = mWindow_.sampleSize;
+	std::vector<GraphVertex> vertices((size_t)sampleSize * sampleSize);
+
+	// every row is stored rotated by the same amount, so it is copied in two pieces
+	const int split = sampleSize - wrap(mWindow_.firstColumn - mOriginColumn_);
+
+	for (int i = 0; i < sampleSize; i++)
+	{
+		const GraphVertex* storedRow = &mSamples_[(size_t)wrap(mWindow_.firstRow + i - mOriginRow_) * sampleSize];
+		GraphVertex* row = &vertices[(size_t)i * sampleSize];
+
+		std::copy(storedRow + sampleSize - split, storedRow + sampleSize, row);
+		std::copy(storedRow, storedRow + sampleSize - split, row + split);
+	}
+
+	return vertices;
+}
+
+int GridSampleCache::wrap(int index) const
+{
+	const int sampleSize = mWindow_.sampleSize;
+	return ((index % sampleSize) + sampleSize) % sampleSize;
+}
+
+GraphVertex* GridSampleCache::storage_row(int row)
+{
+	return &mSamples_[(size_t)wrap(row - mOriginRow_) * mWindow_.sampleSize];
+}
+
+void GridSampleCache::add_spans(int row, int firstColumn, int columnStep, int count, std::vector<GridSpan>& spans)
+{
+	GraphVertex* storedRow = storage_row(row);
+
+	while (count > 0)
+	{
+		const int storedColumn = wrap(firstColumn - mOriginColumn_);
+		const int columnsBeforeWrap = (mWindow_.sampleSize - storedColumn + columnStep - 1) / columnStep;
+		const int spanCount = std::min(count, columnsBeforeWrap);
+
+		spans.push_back({ row, firstColumn, columnStep, spanCount, storedRow + storedColumn });
+
+		firstColumn += spanCount * columnStep;
+		count -= spanCount;
+	}
+}
+
+std::vector<GridSpan> GridSampleCache::move_within_level(const GridWindow& window)
+{
+	const GridWindow previous = mWindow_;
+	const int sampleSize = window.sampleSize;
+
+	// A lattice point's place in storage does not depend on the window, so every point that is new to the window
+	// takes the place of one that has just left it, and the points in both windows are already in the right place
+	mWindow_ = window;
+
+	const int keptFirstColumn = std::max(window.firstColumn, previous.firstColumn);
+	const int keptLastColumn = std::min(window.firstColumn, previous.firstColumn) + sampleSize; // one past the end
+
+	std::vector<GridSpan> spans;
+
+	for (int row = window.firstRow; row < window.firstRow + sampleSize; row++)
+	{
+		const bool isRowKept = row >= previous.firstRow && row < previous.firstRow + sampleSize;
+
+		if (!isRowKept || keptFirstColumn >= keptLastColumn)
+		{
+			add_spans(row, window.firstColumn, 1, sampleSize, spans);
+			continue;
+		}
+
+		add_spans(row, window.firstColumn, 1, keptFirstColumn - window.firstColumn, spans); // exposed on the left
+		add_spans(row, keptLastColumn, 1, window.firstColumn + sampleSize - keptLastColumn, spans); // exposed on the right
+	}
+
+	return spans;
+}
+
+std::vector<GridSpan> GridSampleCache::move_across_level(const GridWindow& window)
+{
+	const GridWindow previous = mWindow_;
+	const int previousOriginRow = mOriginRow_;
+	const int previousOriginColumn = mOriginColumn_;
+	const int sampleSize = window.sampleSize;
+
+	std::vector<GraphVertex> previousSamples((size_t)sampleSize * sampleSize);
+	previousSamples.swap(mSamples_);
+
+	mWindow_ = window;
+	mOriginRow_ = window.firstRow;
+	mOriginColumn_ = window.firstColumn;
+
+	// Zooming out doubles the spacing, so new lattice index k lands on old index 2k.
+	// Zooming in halves it, so only even new indices land on old samples, at old index k / 2
+	const bool isZoomingOut = window.zoomLevel > previous.zoomLevel;
+	const int reusedStep = isZoomingOut ? 1 : 2;
+
+	auto old_index = [&](int index) { return isZoomingOut ? 2 * index : floor_divide(index, 2); };
+
+	// the new lattice indices, first and last, whose old index falls inside [first, first + sampleSize) of the previous window
+	auto reused_range = [&](int previousFirst, int newFirst, int* first, int* last)
+	{
+		*first = isZoomingOut ? -floor_divide(-previousFirst, 2) : 2 * previousFirst;
+		*last = isZoomingOut ? floor_divide(previousFirst + sampleSize - 1, 2) : 2 * (previousFirst + sampleSize - 1);
+
+		*first = std::max(*first, newFirst);
+		*last = std::min(*last, newFirst + sampleSize - 1);
+
+		if (!isZoomingOut) // only even indices are reused
+		{
+			*first += floor_divide(*first, 2) * 2 != *first;
+			*last -= floor_divide(*last, 2) * 2 != *last;
+		}
+	};
+
+	int firstReusedRow, lastReusedRow, firstReusedColumn, lastReusedColumn;
+	reused_range(previous.firstRow, window.firstRow, &firstReusedRow, &lastReusedRow);
+	reused_range(previous.firstColumn, window.firstColumn, &firstReusedColumn, &lastReusedColumn);
+
+	std::vector<GridSpan> spans;
+
+	for (int row = window.firstRow; row < window.firstRow + sampleSize; row++)
+	{
+		const bool isRowReused = row >= firstReusedRow && row <= lastReusedRow && (row - firstReusedRow) % reusedStep == 0;
+
+		if (!isRowReused || firstReusedColumn > lastReusedColumn)
+		{
+			add_spans(row, window.firstColumn, 1, sampleSize, spans);
+			continue;
+		}
+
+		const GraphVertex* previousRow = &previousSamples[(size_t)(((old_index(row) - previousOriginRow) % sampleSize + sampleSize) % sampleSize) * sampleSize];
+		GraphVertex* storedRow = storage_row(row);
+
+		for (int column = firstReusedColumn; column <= lastReusedColumn; column += reusedStep)
+		{
+			const int previousColumn = ((old_index(column) - previousOriginColumn) % sampleSize + sampleSize) % sampleSize;
+			storedRow[column - window.firstColumn] = previousRow[previousColumn];
+		}
+
+		add_spans(row, window.firstColumn, 1, firstReusedColumn - window.firstColumn, spans); // exposed on the left
+		add_spans(row, lastReusedColumn + 1, 1, window.firstColumn + sampleSize - 1 - lastReusedColumn, spans); // exposed on the right
+
+		if (!isZoomingOut) // the new points between the reused ones
+		{
+			add_spans(row, firstReusedColumn + 1, 2, (lastReusedColumn - firstReusedColumn) / 2, spans);
+		}
+	}
+
+	return spans;
+}
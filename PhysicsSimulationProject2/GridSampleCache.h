@@ -0,0 +1,49 @@
+#pragma once
+#include <vector>
+
+#include "GraphLogic.h"
+
+/**
+ * \brief The samples of one graph's grid, kept so that moving or zooming the domain only evaluates the points that have not been sampled yet.
+ * The grid is stored as a torus: a lattice point always lives at the same place in storage, its row and column wrapped around the grid's size,
+ * so panning only overwrites the rows and columns that scrolled out of view. Zooming in or out by one level reuses every sample that still
+ * lies on the new lattice, which is every other sample of the finer grid
+ */
+class GridSampleCache
+{
+public:
+	GridSampleCache();
+
+	bool is_valid() const;
+	void invalidate(); // frees the samples
+	bool can_reuse(const GridWindow& window) const; // true if move_to would keep some of the samples
+
+	/**
+	 * \brief Replaces the cache with a grid that was sampled in one go
+	 * \param vertices - the samples of the window, in the order returned by GraphLogic::sample_points
+	 */
+	void store(const GridWindow& window, const std::vector<GraphVertex>& vertices);
+
+	/**
+	 * \brief Moves the cache onto a new window, keeping the samples that carry over. The rest of the window must be filled in by
+	 * sampling the returned spans with GraphLogic::sample_spans before get_vertices is called, if that is abandoned the cache must be invalidated
+	 * \return the runs of lattice points that still need sampling, they write straight into the cache
+	 */
+	std::vector<GridSpan> move_to(const GridWindow& window);
+
+	std::vector<GraphVertex> get_vertices() const; // the samples in the order returned by GraphLogic::sample_points
+
+private:
+	int wrap(int index) const; // the position of a lattice row or column in storage, relative to the origin
+	GraphVertex* storage_row(int row); // where a lattice row is stored
+	void add_spans(int row, int firstColumn, int columnStep, int count, std::vector<GridSpan>& spans); // splits the run where it wraps around the storage
+
+	std::vector<GridSpan> move_within_level(const GridWindow& window); // the samples stay where they are stored
+	std::vector<GridSpan> move_across_level(const GridWindow& window); // the samples that carry over are copied into new storage
+
+	bool mIsValid_;
+	GridWindow mWindow_;
+	int mOriginRow_; // the lattice row stored first, the rows after it wrap around
+	int mOriginColumn_;
+	std::vector<GraphVertex> mSamples_;
+};
@@ -1,15 +1,20 @@
 #pragma once
 #include <cassert>
 #include <iostream>
-#include <GLFW/glfw3.h>
 #include <vector>
-#include <stack>
+#include <string>
 
 #include "Camera.h"
+#include "GraphLogic.h"
+#include "ExpressionProgram.h"
+
+struct GLFWwindow; // only InputHandler.cpp needs GLFW, so the expression parsing can be used without it
 
 class InputHandler 
 {
 public:
+	static const int maxInputLength = 255; // the text boxes hold 256 characters, including the terminator
+
 	InputHandler();
 	~InputHandler();
 	InputHandler(const InputHandler&) = delete;
@@ -18,7 +23,8 @@ public:
 	InputHandler& operator=(InputHandler&&) = delete; 
 
 	void handle_glfw_input(GLFWwindow* window, Camera& camera, double dt); 
-	static std::vector<std::string> verify_and_convert_function(std::string input, bool* errorFlag); 
+	bool handle_domain_input(GLFWwindow* window, GraphDomain& domain, double dt); // the arrow keys pan the domain and page up and page down zoom it, returns true if it changed 
+	static void verify_and_convert_function(const std::string& input, std::vector<Token>* postfixExpression, bool* errorFlag, int* errorPosition = nullptr); 
 
 private:
 	const float mMovementSpeed_; 
@@ -30,18 +36,7 @@ private:
 	bool mFirstMouse_; 
 
 	bool mMouseIsHeld;
-
-private:
-	static bool is_operator(const char& character_to_check); // checks if the character is an operator 
-	static bool is_left_associative(const char& operator_to_check); // checks if the operator is left associative
-	static int set_precedence(const char& operation); 
-	static bool is_left_parenthesis(const char& character_to_check);
-	static bool is_right_parenthesis(const char& character_to_check); 
-	static bool a_parenthesis_exists_in_stack(std::stack<char> stack_to_check);
-	static bool parenthesis_checker(std::string input); 
-
-	static std::string convert_implicit_expression_to_explicit(std::string input);
-	static std::vector<std::string> shunting_yard_algorithm(std::string input); 
+	bool mZoomKeyIsHeld_; // a zoom key changes the zoom level once per press, not once per frame 
 
 private:
 	static bool mIsInstantiated_; 
@@ -0,0 +1,222 @@
+#include "InputHandler.h"
+#include <cstdlib>
+#include <cstring>
+
+// The text box input is parsed here, apart from the window input in InputHandler.cpp, so that tools without a window can parse expressions without linking GLFW
+
+namespace
+{
+	// An operator or left parenthesis waiting on the shunting yard's stack
+	struct PendingOperator
+	{
+		char character;
+		int position; // where it was typed, so an unclosed parenthesis can be reported
+	};
+
+	bool is_operator(char character)
+	{
+		switch (character)
+		{
+		case '^':
+		case '*':
+		case '/':
+		case '+':
+		case '-':
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	int get_precedence(char operation) // a left parenthesis has the lowest precedence, so no operator is ever popped past it
+	{
+		switch (operation)
+		{
+		case '^':
+			return 4;
+		case '*':
+		case '/':
+			return 3;
+		case '+':
+		case '-':
+			return 2;
+		default:
+			return 0;
+		}
+	}
+
+	TokenKind get_operator_kind(char operation)
+	{
+		switch (operation)
+		{
+		case '^':
+			return TokenKind::Power;
+		case '*':
+			return TokenKind::Multiply;
+		case '/':
+			return TokenKind::Divide;
+		case '+':
+			return TokenKind::Add;
+		default:
+			return TokenKind::Subtract;
+		}
+	}
+}
+
+/**
+ * \brief This is the main function for handling the input in the text boxes and converting that input into an expression that the computer can understand.
+ * The input is validated, implicit multiplications are inserted, the parentheses are matched and the shunting yard algorithm is run all in the same pass
+ * over the characters, and no memory is allocated once postfixExpression has grown to fit the longest input it has been given
+ * \param input - the text that the user entered
+ * \param postfixExpression - cleared, then filled with the expression in postfix order, e.g. "2x" gives { 2, x, * }. Empty if the input was empty or invalid
+ * \param errorFlag - pointer to a bool, so that the main function can be notified if there has been an error
+ * \param errorPosition - optional, set to the index in input of the first character that is not valid, or to its length if the input ended too early
+ */
+void InputHandler::verify_and_convert_function(const std::string& input, std::vector<Token>* postfixExpression, bool* errorFlag, int* errorPosition)
+{
+	postfixExpression->clear();
+
+	const int length = (int)input.size();
+
+	auto fail = [&](int position)
+	{
+		postfixExpression->clear();
+		*errorFlag = true; // This means that the input the user entered was false
+		if (errorPosition != nullptr) *errorPosition = position;
+	};
+
+	if (length > maxInputLength)
+	{
+		fail(maxInputLength);
+		return;
+	}
+
+	// every character becomes at most one token, plus the multiplication that may be implied before it
+	postfixExpression->reserve(2 * length);
+
+	PendingOperator operatorStack[maxInputLength]; // every entry is a character of the input or the multiplication implied before one
+	int stackSize = 0;
+
+	auto push_operator = [&](char operation, int position)
+	{
+		const int precedence = get_precedence(operation);
+		const bool isLeftAssociative = operation != '^';
+
+		while (stackSize > 0)
+		{
+			const int precedenceOnStack = get_precedence(operatorStack[stackSize - 1].character);
+			if (isLeftAssociative ? precedence > precedenceOnStack : precedence >= precedenceOnStack) break;
+
+			postfixExpression->push_back({ get_operator_kind(operatorStack[--stackSize].character), 0.f });
+		}
+		operatorStack[stackSize++] = { operation, position };
+	};
+
+	bool isOperandExpected = true; // false straight after a number, x, y or a right parenthesis
+	char lastSeenCharacter = ' '; // we keep track of the last seen character barring spaces
+
+	for (int i = 0; i < length; i++)
+	{
+		const char character = input[i];
+
+		if (character == ' ') continue;
+
+		if (isdigit((unsigned char)character))
+		{
+			if (lastSeenCharacter == ')') // (x+1)2
+			{
+				push_operator('*', i);
+			}
+			else if (!isOperandExpected) // e.g. "x2", which is ambiguous, or "2 3"
+			{
+				fail(i);
+				return;
+			}
+
+			int end = i;
+			while (end < length && isdigit((unsigned char)input[end])) end++;
+
+			// The number is converted only once, here. It is copied out first, as strtof would read "0x1" as hexadecimal
+			char digits[maxInputLength + 1];
+			std::memcpy(digits, &input[i], end - i);
+			digits[end - i] = '\0';
+
+			postfixExpression->push_back({ TokenKind::Number, std::strtof(digits, nullptr) });
+
+			isOperandExpected = false;
+			i = end - 1;
+		}
+		else if (character == 'x' || character == 'y' || character == '(')
+		{
+			// Allows the user to input implicit functions such as 2x + y or (x+1)(y+1), instead of 2*x + y
+			if (!isOperandExpected) push_operator('*', i);
+
+			if (character == '(')
+			{
+				operatorStack[stackSize++] = { character, i };
+				isOperandExpected = true;
+			}
+			else
+			{
+				postfixExpression->push_back({ character == 'x' ? TokenKind::X : TokenKind::Y, 0.f });
+				isOperandExpected = false;
+			}
+		}
+		else if (is_operator(character))
+		{
+			if (isOperandExpected) // the expression starts with an operator, or two operators are in a row
+			{
+				fail(i);
+				return;
+			}
+
+			push_operator(character, i);
+			isOperandExpected = true;
+		}
+		else if (character == ')')
+		{
+			if (isOperandExpected) // empty parentheses, or an operator with nothing after it
+			{
+				fail(i);
+				return;
+			}
+
+			while (stackSize > 0 && operatorStack[stackSize - 1].character != '(')
+			{
+				postfixExpression->push_back({ get_operator_kind(operatorStack[--stackSize].character), 0.f });
+			}
+
+			if (stackSize == 0) // there is no matching '(' character
+			{
+				fail(i);
+				return;
+			}
+			stackSize--;
+		}
+		else // not an operator, a digit, x, y, a parenthesis or a space
+		{
+			fail(i);
+			return;
+		}
+
+		lastSeenCharacter = character;
+	}
+
+	if (isOperandExpected && (!postfixExpression->empty() || stackSize > 0)) // the input ended with an operator or a '('
+	{
+		fail(length);
+		return;
+	}
+
+	while (stackSize > 0)
+	{
+		const PendingOperator& pending = operatorStack[--stackSize];
+
+		if (pending.character == '(') // there are '(' characters left and no ')' characters to balance them
+		{
+			fail(pending.position);
+			return;
+		}
+		postfixExpression->push_back({ get_operator_kind(pending.character), 0.f });
+	}
+}
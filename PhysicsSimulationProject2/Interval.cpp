@@ -0,0 +1,192 @@
+#include "Interval.h"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace
+{
+	const float infinity = std::numeric_limits<float>::infinity();
+
+	// Every bound is moved one representable float outwards, which covers the rounding error of a single operation
+	Interval round_outwards(float lower, float upper)
+	{
+		if (std::isnan(lower) || std::isnan(upper)) return Interval::entire(); // e.g. 0 * inf, nothing is known about the result
+
+		return { std::nextafter(lower, -infinity), std::nextafter(upper, infinity) };
+	}
+
+	// x^n for an integer n >= 1, using pow so the bounds match the sampled values
+	Interval positive_integer_power(const Interval& base, int exponent)
+	{
+		const float atLower = std::pow(base.lower, (float)exponent);
+		const float atUpper = std::pow(base.upper, (float)exponent);
+
+		if (exponent % 2 == 1) return round_outwards(atLower, atUpper); // odd powers are increasing
+
+		if (base.contains_zero()) return round_outwards(0.f, std::max(atLower, atUpper)); // even powers have their minimum at zero
+
+		return round_outwards(std::min(atLower, atUpper), std::max(atLower, atUpper));
+	}
+
+	// x^n for n >= 1 by repeated squaring from the most significant bit down, the same multiplications the samples are calculated with
+	float repeated_squaring(float base, int exponent, int* multiplications)
+	{
+		int highestBit = 0;
+		while ((exponent >> (highestBit + 1)) != 0) highestBit++;
+
+		float result = base;
+		*multiplications = 0;
+
+		for (int bit = highestBit - 1; bit >= 0; bit--)
+		{
+			result *= result;
+			(*multiplications)++;
+
+			if ((exponent >> bit) & 1)
+			{
+				result *= base;
+				(*multiplications)++;
+			}
+		}
+
+		return result;
+	}
+
+	// Each multiplication is out by at most half an ulp, so after k of them a power is within about k ulps of x^n. A sample and a bound
+	// can each be out by that much in opposite directions, so the bound is moved by twice it, plus FLT_MIN for results that underflow
+	float widen(float bound, int multiplications, float direction)
+	{
+		const float relativeError = 2.f * multiplications * std::numeric_limits<float>::epsilon();
+		return bound + direction * (std::fabs(bound) * relativeError + std::numeric_limits<float>::min());
+	}
+}
+
+Interval Interval::point(float value)
+{
+	return { value, value };
+}
+
+Interval Interval::entire()
+{
+	return { -infinity, infinity };
+}
+
+bool Interval::contains_zero() const
+{
+	return lower <= 0.f && upper >= 0.f;
+}
+
+bool Interval::is_bounded() const
+{
+	return std::isfinite(lower) && std::isfinite(upper);
+}
+
+float Interval::width() const
+{
+	return upper - lower;
+}
+
+Interval Interval::add(const Interval& a, const Interval& b)
+{
+	return round_outwards(a.lower + b.lower, a.upper + b.upper);
+}
+
+Interval Interval::subtract(const Interval& a, const Interval& b)
+{
+	return round_outwards(a.lower - b.upper, a.upper - b.lower);
+}
+
+Interval Interval::multiply(const Interval& a, const Interval& b)
+{
+	// the extremes of a product are always found at a pair of end points
+	const float products[4] = { a.lower * b.lower, a.lower * b.upper, a.upper * b.lower, a.upper * b.upper };
+
+	for (float product : products)
+	{
+		if (std::isnan(product)) return entire();
+	}
+
+	return round_outwards(*std::min_element(products, products + 4), *std::max_element(products, products + 4));
+}
+
+Interval Interval::divide(const Interval& a, const Interval& b)
+{
+	if (!b.contains_zero())
+	{
+		return multiply(a, round_outwards(1.f / b.upper, 1.f / b.lower));
+	}
+
+	// The divisor reaches zero, so there is a pole in the region. If it only touches zero at one end we still know which way the result goes
+	if (a.contains_zero() || (b.lower == 0.f && b.upper == 0.f)) return entire();
+
+	const bool isDividendPositive = a.lower > 0.f;
+
+	if (b.lower == 0.f) // the divisor is [0, u], so the result heads away from zero in the direction of the dividend
+	{
+		return isDividendPositive ? round_outwards(a.lower / b.upper, infinity) : round_outwards(-infinity, a.upper / b.upper);
+	}
+	if (b.upper == 0.f) // the divisor is [l, 0]
+	{
+		return isDividendPositive ? round_outwards(-infinity, a.lower / b.lower) : round_outwards(a.upper / b.lower, infinity);
+	}
+
+	return entire(); // the divisor changes sign, so the result approaches both infinities
+}
+
+Interval Interval::power(const Interval& base, const Interval& exponent)
+{
+	const bool isConstantExponent = exponent.lower == exponent.upper;
+
+	if (isConstantExponent && exponent.lower == std::floor(exponent.lower) && std::fabs(exponent.lower) <= 1 << 24)
+	{
+		const int integerExponent = (int)exponent.lower;
+
+		if (integerExponent == 0) return point(1.f); // pow(x, 0) is 1 for every x, even zero
+		if (integerExponent > 0) return positive_integer_power(base, integerExponent);
+
+		return divide(point(1.f), positive_integer_power(base, -integerExponent)); // x^-n = 1 / x^n, which has a pole if the base contains zero
+	}
+
+	if (base.lower <= 0.f) return entire(); // pow of a negative base is undefined for fractional exponents, and 0^-a is a pole
+
+	// For a positive base, x^y = e^(y ln x) is monotonic in x and in y, so its extremes are found at the corners
+	const float corners[4] = { std::pow(base.lower, exponent.lower), std::pow(base.lower, exponent.upper), std::pow(base.upper, exponent.lower), std::pow(base.upper, exponent.upper) };
+
+	return round_outwards(*std::min_element(corners, corners + 4), *std::max_element(corners, corners + 4));
+}
+
+Interval Interval::integer_power(const Interval& base, int exponent)
+{
+	if (exponent == 0) return point(1.f); // x^0 is 1 for every x, even zero
+
+	const int magnitude = exponent < 0 ? -exponent : exponent;
+
+	int multiplications;
+	const float atLower = repeated_squaring(base.lower, magnitude, &multiplications);
+	const float atUpper = repeated_squaring(base.upper, magnitude, &multiplications);
+
+	float lower;
+	float upper;
+
+	if (magnitude % 2 == 1) // odd powers are increasing
+	{
+		lower = atLower;
+		upper = atUpper;
+	}
+	else if (base.contains_zero()) // even powers have their minimum at zero, which every multiplication keeps exact
+	{
+		lower = 0.f;
+		upper = std::max(atLower, atUpper);
+	}
+	else
+	{
+		lower = std::min(atLower, atUpper);
+		upper = std::max(atLower, atUpper);
+	}
+
+	if (lower != 0.f) lower = widen(lower, multiplications, -1.f);
+	if (upper != 0.f) upper = widen(upper, multiplications, 1.f);
+
+	const Interval result = round_outwards(lower, upper);
+	return exponent < 0 ? divide(point(1.f), result) : result; // x^-n = 1 / x^n, which has a pole if the base contains zero
+}
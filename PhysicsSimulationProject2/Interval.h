@@ -0,0 +1,42 @@
+#pragma once
+
+/**
+ * \brief A range of values that is guaranteed to contain every value an expression can take over a region of the graph.
+ * Every operation rounds its bounds outwards, so the result still holds despite floating point error. An interval with an
+ * infinite bound means the expression may have a pole (or be undefined) somewhere in the region
+ */
+struct Interval
+{
+	float lower;
+	float upper;
+
+	static Interval point(float value); // the interval holding a single value
+	static Interval entire(); // every value is possible, used whenever nothing better can be said
+
+	bool contains_zero() const;
+	bool is_bounded() const; // false if the expression may reach infinity or be undefined in the region
+	float width() const;
+
+	static Interval add(const Interval& a, const Interval& b);
+	static Interval subtract(const Interval& a, const Interval& b);
+	static Interval multiply(const Interval& a, const Interval& b);
+
+	/**
+	 * \brief Divides two intervals, a divisor that touches zero gives an unbounded result
+	 * \return a half infinite interval if the divisor only touches zero at one end and the dividend does not contain zero, otherwise the entire line
+	 */
+	static Interval divide(const Interval& a, const Interval& b);
+
+	/**
+	 * \brief Raises an interval to a power, matching the std::pow calls used when sampling
+	 * \return tight bounds for constant integer exponents (even powers of an interval containing zero start at zero) and for positive bases,
+	 * the entire line for a negative base with a fractional exponent, where pow is undefined
+	 */
+	static Interval power(const Interval& base, const Interval& exponent);
+
+	/**
+	 * \brief Raises an interval to a constant integer power, matching the repeated squaring OpCode::IntegerPower is sampled with
+	 * \return the bounds found by the same multiplications, widened by the rounding error those multiplications can build up
+	 */
+	static Interval integer_power(const Interval& base, int exponent);
+};
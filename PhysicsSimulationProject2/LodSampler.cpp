@@ -0,0 +1,250 @@
+#include "LodSampler.h"
+#include <cmath>
+#include <algorithm>
+
+#include "ThreadPool.h"
+
+LodSampler::LodSampler(const ExpressionJit& evaluator, int sampleSize, const GraphDomain& domain) :
+	mEvaluator_(evaluator),
+	mFinestCells_(minPatchCells),
+	mFirstRow_(0),
+	mFirstColumn_(0),
+	mSpacing_(0.f),
+	mPatches_(patchesPerAxis * patchesPerAxis)
+{
+	// the finest patches together have about as many samples as the grid would, so raising the resolution only adds detail near the camera
+	while (mFinestCells_ * 2 * patchesPerAxis <= sampleSize) mFinestCells_ *= 2;
+
+	const int latticeSize = mFinestCells_ * patchesPerAxis;
+
+	mSpacing_ = std::ldexp(GraphLogic::domainWidth / latticeSize, domain.zoomLevel);
+	mFirstRow_ = (int)std::floor(domain.centreX / mSpacing_ + 0.5f) - latticeSize / 2;
+	mFirstColumn_ = (int)std::floor(domain.centreY / mSpacing_ + 0.5f) - latticeSize / 2;
+}
+
+AdaptiveMesh LodSampler::sample(const ExpressionJit& evaluator, int sampleSize, const GraphDomain& domain, const LodView& view, const std::atomic<bool>* cancelFlag)
+{
+	if (evaluator.get_program().is_empty()) return {}; // the user entered an empty expression
+
+	if (sampleSize < GraphLogic::minSampleSize || sampleSize > GraphLogic::maxSampleSize) abort(); // invalid sample size was entered
+
+	LodSampler sampler(evaluator, sampleSize, domain);
+	sampler.choose_levels(view);
+
+	unsigned int vertexCount = 0;
+	for (Patch& patch : sampler.mPatches_)
+	{
+		patch.firstVertex = vertexCount;
+		vertexCount += (patch.cells + 1) * (patch.cells + 1);
+	}
+
+	AdaptiveMesh mesh;
+	mesh.vertices.resize(vertexCount);
+
+	// every patch writes to its own vertices, so they are sampled in parallel
+	ThreadPool::get_shared_pool().parallel_for(patchesPerAxis * patchesPerAxis, [&](int patch)
+	{
+		if (cancelFlag != nullptr && *cancelFlag) return;
+		sampler.sample_patch(patch / patchesPerAxis, patch % patchesPerAxis, mesh.vertices);
+	});
+
+	if (cancelFlag != nullptr && *cancelFlag) return {};
+
+	for (int px = 0; px < patchesPerAxis; px++)
+	{
+		for (int py = 0; py < patchesPerAxis; py++)
+		{
+			sampler.triangulate_patch(px, py, mesh.indices);
+		}
+	}
+
+	return mesh;
+}
+
+/**
+ * \brief The heights at the patches' corners are sampled first, so each patch can be given a bounding box. A patch that is entirely
+ * outside the view is given the coarsest level, any other is refined until its cells would be about targetCellPixels wide at the point
+ * of its box nearest the camera
+ */
+void LodSampler::choose_levels(const LodView& view)
+{
+	const int cornerCount = patchesPerAxis + 1;
+	std::vector<float> cornerX(cornerCount);
+	std::vector<float> cornerY(cornerCount);
+	for (int i = 0; i < cornerCount; i++)
+	{
+		cornerX[i] = (float)(mFirstRow_ + i * mFinestCells_) * mSpacing_;
+		cornerY[i] = (float)(mFirstColumn_ + i * mFinestCells_) * mSpacing_;
+	}
+
+	std::vector<float> cornerZ(cornerCount * cornerCount);
+	std::vector<float> rowX(cornerCount);
+	ExpressionProgram::RowValues rowValues;
+
+	for (int i = 0; i < cornerCount; i++)
+	{
+		std::fill(rowX.begin(), rowX.end(), cornerX[i]);
+		mEvaluator_.prepare_row(cornerX[i], &rowValues);
+		mEvaluator_.evaluate_batch(rowX.data(), cornerY.data(), &cornerZ[i * cornerCount], cornerCount, &rowValues);
+	}
+
+	const glm::mat4 clipFromGraph = view.projection * view.view * view.model;
+	const glm::vec3 cameraPosition = glm::vec3(glm::inverse(view.view)[3]);
+	const float pixelsAtUnitDistance = view.projection[1][1] * view.viewportHeight / 2.f; // the size on screen of one unit of world space, one unit away
+
+	int finestLevel = 0;
+	while ((minPatchCells << finestLevel) < mFinestCells_) finestLevel++;
+
+	for (int px = 0; px < patchesPerAxis; px++)
+	{
+		for (int py = 0; py < patchesPerAxis; py++)
+		{
+			float lowest = 0.f;
+			float highest = 0.f;
+			bool isFirstHeight = true;
+
+			for (int corner = 0; corner < 4; corner++)
+			{
+				const float z = cornerZ[(px + (corner & 1)) * cornerCount + py + (corner >> 1)];
+				if (!std::isfinite(z)) continue; // a pole, the rest of the patch is still bounded by the other corners
+
+				lowest = isFirstHeight ? z : std::min(lowest, z);
+				highest = isFirstHeight ? z : std::max(highest, z);
+				isFirstHeight = false;
+			}
+
+			// the patch's bounding box, in world space and in clip space. The graph's y axis is drawn along world z
+			glm::vec3 worldLow(1e30f);
+			glm::vec3 worldHigh(-1e30f);
+			bool isOutside[6] = { true, true, true, true, true, true };
+
+			for (int corner = 0; corner < 8; corner++)
+			{
+				const glm::vec4 graphPoint(cornerX[px + (corner & 1)], (corner & 4) ? highest : lowest, cornerY[py + ((corner >> 1) & 1)], 1.f);
+
+				const glm::vec3 worldPoint = glm::vec3(view.model * graphPoint);
+				worldLow = glm::min(worldLow, worldPoint);
+				worldHigh = glm::max(worldHigh, worldPoint);
+
+				const glm::vec4 clipPoint = clipFromGraph * graphPoint;
+				isOutside[0] &= clipPoint.x < -clipPoint.w;
+				isOutside[1] &= clipPoint.x > clipPoint.w;
+				isOutside[2] &= clipPoint.y < -clipPoint.w;
+				isOutside[3] &= clipPoint.y > clipPoint.w;
+				isOutside[4] &= clipPoint.z < -clipPoint.w;
+				isOutside[5] &= clipPoint.z > clipPoint.w;
+			}
+
+			const bool isVisible = std::none_of(isOutside, isOutside + 6, [](bool outside) { return outside; });
+
+			const glm::vec3 nearestPoint = glm::clamp(cameraPosition, worldLow, worldHigh);
+			const float distance = std::max(glm::length(nearestPoint - cameraPosition), 1e-3f);
+
+			const float patchWidth = std::max(worldHigh.x - worldLow.x, worldHigh.z - worldLow.z);
+			const float cellsWanted = patchWidth * pixelsAtUnitDistance / distance / targetCellPixels;
+
+			int level = 0;
+			while (isVisible && level < finestLevel && (float)(minPatchCells << level) < cellsWanted) level++;
+
+			mPatches_[px * patchesPerAxis + py].cells = minPatchCells << level;
+		}
+	}
+}
+
+void LodSampler::sample_patch(int px, int py, std::vector<GraphVertex>& vertices) const
+{
+	const Patch& patch = mPatches_[px * patchesPerAxis + py];
+	const int pointsPerSide = patch.cells + 1;
+	const int step = mFinestCells_ / patch.cells; // in lattice units
+
+	// every position comes from its lattice indices, so a point shared with a neighbouring patch is sampled at exactly the same place
+	const int firstRow = mFirstRow_ + px * mFinestCells_;
+	const int firstColumn = mFirstColumn_ + py * mFinestCells_;
+
+	std::vector<float> rowX(pointsPerSide);
+	std::vector<float> rowY(pointsPerSide);
+	std::vector<float> rowZ(pointsPerSide);
+	std::vector<float> rowDzdx(pointsPerSide);
+	std::vector<float> rowDzdy(pointsPerSide);
+	ExpressionProgram::RowValues rowValues;
+
+	for (int j = 0; j < pointsPerSide; j++)
+	{
+		rowY[j] = (float)(firstColumn + j * step) * mSpacing_;
+	}
+
+	for (int i = 0; i < pointsPerSide; i++)
+	{
+		const float x = (float)(firstRow + i * step) * mSpacing_;
+		std::fill(rowX.begin(), rowX.end(), x);
+
+		mEvaluator_.prepare_row(x, &rowValues);
+		mEvaluator_.evaluate_batch_with_gradient(rowX.data(), rowY.data(), rowZ.data(), rowDzdx.data(), rowDzdy.data(), pointsPerSide, &rowValues);
+
+		GraphVertex* rowPoints = &vertices[patch.firstVertex + i * pointsPerSide];
+		for (int j = 0; j < pointsPerSide; j++)
+		{
+			rowPoints[j] = { { x, rowZ[j], rowY[j] }, GraphLogic::surface_normal(rowDzdx[j], rowDzdy[j]) }; // same layout as the grid, z is up
+		}
+	}
+}
+
+void LodSampler::triangulate_patch(int px, int py, std::vector<unsigned int>& indices) const
+{
+	const Patch& patch = mPatches_[px * patchesPerAxis + py];
+	const int pointsPerSide = patch.cells + 1;
+
+	// the vertex every vertex of the patch is drawn with, vertices on an edge shared with a coarser patch are folded onto its vertices
+	std::vector<unsigned int> drawnVertex(pointsPerSide * pointsPerSide);
+	for (int i = 0; i < pointsPerSide * pointsPerSide; i++) drawnVertex[i] = patch.firstVertex + i;
+
+	const int neighbourX[4] = { -1, 1, 0, 0 };
+	const int neighbourY[4] = { 0, 0, -1, 1 };
+
+	for (int side = 0; side < 4; side++)
+	{
+		const int nx = px + neighbourX[side];
+		const int ny = py + neighbourY[side];
+		if (nx < 0 || ny < 0 || nx >= patchesPerAxis || ny >= patchesPerAxis) continue; // the edge of the domain
+
+		const int neighbourCells = mPatches_[nx * patchesPerAxis + ny].cells;
+		if (neighbourCells >= patch.cells) continue; // the finer patch of the two does the folding
+
+		const int ratio = patch.cells / neighbourCells;
+
+		for (int k = 0; k < pointsPerSide; k++)
+		{
+			const int kept = k - k % ratio; // the coarse patch's vertex at or before this one
+			const int row = neighbourX[side] == 0 ? k : (neighbourX[side] < 0 ? 0 : patch.cells);
+			const int column = neighbourY[side] == 0 ? k : (neighbourY[side] < 0 ? 0 : patch.cells);
+			const int keptRow = neighbourX[side] == 0 ? kept : row;
+			const int keptColumn = neighbourY[side] == 0 ? kept : column;
+
+			drawnVertex[row * pointsPerSide + column] = patch.firstVertex + keptRow * pointsPerSide + keptColumn;
+		}
+	}
+
+	// the same two triangles per cell as GraphLogic::get_grid_indices, triangles that fold down to a line are left out
+	auto add_triangle = [&](int a, int b, int c)
+	{
+		const unsigned int va = drawnVertex[a];
+		const unsigned int vb = drawnVertex[b];
+		const unsigned int vc = drawnVertex[c];
+		if (va == vb || vb == vc || va == vc) return;
+
+		indices.push_back(va);
+		indices.push_back(vb);
+		indices.push_back(vc);
+	};
+
+	for (int i = 0; i < patch.cells; i++)
+	{
+		for (int j = 0; j < patch.cells; j++)
+		{
+			const int index = i + j * pointsPerSide;
+
+			add_triangle(index, index + pointsPerSide + 1, index + 1);
+			add_triangle(index, index + pointsPerSide, index + pointsPerSide + 1);
+		}
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <vector>
+#include <atomic>
+
+#include "glm/glm.hpp"
+
+#include "ExpressionJit.h"
+#include "GraphLogic.h"
+#include "AdaptiveSampler.h"
+
+// Where a graph is seen from, the same transforms it is drawn with
+struct LodView
+{
+	glm::mat4 model;
+	glm::mat4 view;
+	glm::mat4 projection;
+	float viewportHeight; // in pixels
+};
+
+/**
+ * \brief Samples a graph with a level of detail that depends on where it is seen from. The domain is split into square patches, and each
+ * patch is sampled as a regular grid whose resolution is picked from how large the patch appears on screen, so near patches stay sharp
+ * while distant and off screen ones use only a few samples. Every resolution is a power of two and all patches lie on one lattice, so the
+ * edge of a coarse patch is also an edge of its finer neighbours. Along such an edge the finer patch's extra vertices are folded onto
+ * the coarse patch's vertices, which stitches the seam without any cracks or T-junctions
+ */
+class LodSampler
+{
+public:
+	static const int patchesPerAxis = 8;
+	static const int minPatchCells = 2; // the cells along each side of a patch at the coarsest level
+	static constexpr float targetCellPixels = 6.f; // patches are refined until their cells are about this wide on screen
+
+	/**
+	 * \brief Builds the mesh of a graph
+	 * \param evaluator - the compiled expression
+	 * \param sampleSize - the resolution of the grid the graph would otherwise be sampled with, no patch is sampled more finely than this
+	 * \param domain - the part of the plane to sample
+	 * \param view - where the graph is seen from
+	 * \param cancelFlag - optional, if it becomes true sampling stops early and the returned data must be ignored
+	 */
+	static AdaptiveMesh sample(const ExpressionJit& evaluator, int sampleSize, const GraphDomain& domain, const LodView& view, const std::atomic<bool>* cancelFlag = nullptr);
+
+private:
+	struct Patch
+	{
+		int cells; // along each side
+		unsigned int firstVertex; // the patch's vertices are stored row by row from here
+	};
+
+	LodSampler(const ExpressionJit& evaluator, int sampleSize, const GraphDomain& domain);
+
+	void choose_levels(const LodView& view); // picks every patch's resolution from its size on screen
+	void sample_patch(int px, int py, std::vector<GraphVertex>& vertices) const;
+	void triangulate_patch(int px, int py, std::vector<unsigned int>& indices) const; // folds the edges shared with coarser patches
+
+	const ExpressionJit& mEvaluator_;
+	int mFinestCells_; // the cells along each side of a patch at the finest level, which is the spacing of the lattice
+	int mFirstRow_; // the lattice row and column of the domain's first corner, as in GridWindow
+	int mFirstColumn_;
+	float mSpacing_;
+	std::vector<Patch> mPatches_; // patchesPerAxis * patchesPerAxis, row by row
+};
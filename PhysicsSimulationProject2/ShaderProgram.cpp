@@ -0,0 +1,120 @@
+#include "ShaderProgram.h"
+#include <cassert>
+#include <iostream>
+
+ShaderProgram::ShaderProgram() :
+	mProgram_(0)
+{
+}
+
+ShaderProgram::~ShaderProgram()
+{
+	// GL objects cannot be deleted here, the context may already be gone, so release() must have been called
+	assert(mProgram_ == 0);
+}
+
+unsigned int ShaderProgram::compile_shader(GLenum type, const std::string& source)
+{
+	const char* sourceCString = source.c_str(); // shaders require their code as a cString
+
+	unsigned int shader = glCreateShader(type);
+	glShaderSource(shader, 1, &sourceCString, NULL);
+	glCompileShader(shader);
+
+	int success;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		char log[512];
+		glGetShaderInfoLog(shader, 512, NULL, log);
+		std::cout << log << std::endl;
+
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+bool ShaderProgram::link(unsigned int vertexShader, unsigned int fragmentShader)
+{
+	const unsigned int program = glCreateProgram();
+	glAttachShader(program, vertexShader);
+	glAttachShader(program, fragmentShader);
+	glLinkProgram(program);
+	glDetachShader(program, vertexShader); // the shaders belong to the caller, and can be linked into other programs
+	glDetachShader(program, fragmentShader);
+
+	int success;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		char log[512];
+		glGetProgramInfoLog(program, 512, NULL, log);
+		std::cout << log << std::endl;
+
+		glDeleteProgram(program);
+		return false;
+	}
+
+	if (mProgram_ != 0) glDeleteProgram(mProgram_);
+	mProgram_ = program;
+	mUniformLocations_.clear();
+
+	// uniforms in a block have no location, they are set through the block's buffer
+	int uniformCount = 0;
+	glGetProgramiv(mProgram_, GL_ACTIVE_UNIFORMS, &uniformCount);
+
+	for (int i = 0; i < uniformCount; i++)
+	{
+		char name[256];
+		int size;
+		GLenum type;
+		glGetActiveUniform(mProgram_, i, sizeof(name), NULL, &size, &type, name);
+
+		const int location = glGetUniformLocation(mProgram_, name);
+		if (location != -1) mUniformLocations_[name] = location;
+	}
+
+	return true;
+}
+
+void ShaderProgram::use() const
+{
+	glUseProgram(mProgram_);
+}
+
+int ShaderProgram::get_uniform_location(const std::string& name) const
+{
+	const std::map<std::string, int>::const_iterator location = mUniformLocations_.find(name);
+	return location == mUniformLocations_.end() ? -1 : location->second;
+}
+
+unsigned int ShaderProgram::get_id() const
+{
+	return mProgram_;
+}
+
+void ShaderProgram::release()
+{
+	if (mProgram_ != 0) glDeleteProgram(mProgram_);
+
+	mProgram_ = 0;
+	mUniformLocations_.clear();
+}
+
+unsigned int ShaderProgram::create_scene_buffer()
+{
+	unsigned int buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(SceneUniforms), NULL, GL_DYNAMIC_DRAW); // rewritten every frame
+	glBindBufferBase(GL_UNIFORM_BUFFER, sceneBinding, buffer);
+
+	return buffer;
+}
+
+void ShaderProgram::update_scene_buffer(unsigned int buffer, const SceneUniforms& scene)
+{
+	glNamedBufferSubData(buffer, 0, sizeof(SceneUniforms), &scene); // the buffer stays bound to sceneBinding, so it does not need binding again
+}
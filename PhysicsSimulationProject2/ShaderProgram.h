@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include <map>
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+/**
+ * \brief The state shared by every graph's shader, kept in one uniform buffer so that a frame sets all of it with a single call.
+ * The layout matches the Scene block in the shaders, std140, so every member is aligned to 16 bytes
+ */
+struct SceneUniforms
+{
+	static const int maxGraphs = 10; // the length of the arrays in the Scene block
+
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::mat4 models[maxGraphs]; // every graph is drawn as the instance with its index, which picks its model matrix and colour
+	glm::vec4 colours[maxGraphs];
+	int isLit; // false when the graphs are drawn as wireframes
+	int padding[3];
+};
+
+/**
+ * \brief A linked shader program. Every active uniform's location is looked up once when the program is linked, so no locations are
+ * asked of the driver while drawing
+ */
+class ShaderProgram
+{
+public:
+	static const unsigned int sceneBinding = 0; // the uniform buffer binding of the Scene block, the same in every shader
+
+	ShaderProgram();
+	~ShaderProgram();
+	ShaderProgram(const ShaderProgram&) = delete;
+	ShaderProgram(ShaderProgram&&) = delete;
+	ShaderProgram& operator=(const ShaderProgram&) = delete;
+	ShaderProgram& operator=(ShaderProgram&&) = delete;
+
+	/**
+	 * \brief Compiles one stage of a program, requires an OpenGL context
+	 * \return the shader object, or 0 if the source did not compile, in which case the compiler's log is printed
+	 */
+	static unsigned int compile_shader(GLenum type, const std::string& source);
+
+	/**
+	 * \brief Links two compiled shaders into the program, replacing the program that was linked before
+	 * \return false if they could not be linked, in which case the previous program is kept
+	 */
+	bool link(unsigned int vertexShader, unsigned int fragmentShader);
+
+	void use() const;
+	int get_uniform_location(const std::string& name) const; // -1 if the program has no such uniform, e.g. because it was optimised away
+	unsigned int get_id() const; // 0 if nothing has been linked
+	void release(); // must be called before the context is destroyed
+
+	/**
+	 * \brief Creates the uniform buffer holding the Scene block and binds it to sceneBinding, where every program reads it from
+	 * \return the buffer, which must be deleted before the context is destroyed. Its few hundred bytes are not counted by GraphMesh::get_live_buffer_bytes
+	 */
+	static unsigned int create_scene_buffer();
+	static void update_scene_buffer(unsigned int buffer, const SceneUniforms& scene); // replaces the whole block in one call
+
+private:
+	unsigned int mProgram_;
+	std::map<std::string, int> mUniformLocations_;
+};
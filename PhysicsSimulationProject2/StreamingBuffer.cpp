@@ -0,0 +1,120 @@
+#include "StreamingBuffer.h"
+#include <cassert>
+
+StreamingBuffer::StreamingBuffer() :
+	mBuffer_(0),
+	mMapping_(nullptr),
+	mCapacity_(0),
+	mHead_(0),
+	mFenced_(0),
+	mRetired_(0)
+{
+}
+
+StreamingBuffer::~StreamingBuffer()
+{
+	// GL objects cannot be deleted here, the context may already be gone, so release() must have been called
+	assert(mBuffer_ == 0);
+}
+
+void StreamingBuffer::create(size_t capacity)
+{
+	assert(mBuffer_ == 0);
+
+	// mapped once and kept mapped, the GPU sees every write without it being flushed or the buffer being unmapped
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	glCreateBuffers(1, &mBuffer_);
+	glNamedBufferStorage(mBuffer_, capacity, nullptr, flags);
+	mMapping_ = (unsigned char*)glMapNamedBufferRange(mBuffer_, 0, capacity, flags);
+
+	mCapacity_ = capacity;
+	mHead_ = 0;
+	mFenced_ = 0;
+	mRetired_ = 0;
+}
+
+void* StreamingBuffer::allocate(size_t byteCount, size_t* offset)
+{
+	assert(mBuffer_ != 0 && byteCount <= mCapacity_);
+
+	unsigned long long start = mHead_;
+	if (start % mCapacity_ + byteCount > mCapacity_) start += mCapacity_ - start % mCapacity_; // an allocation is never split, so it starts again at the beginning
+
+	while (start + byteCount - mRetired_ > mCapacity_)
+	{
+		if (mFences_.empty()) fence(); // the ring was filled by a single upload, its earlier copies have been issued so they can be waited for
+		if (mFences_.empty()) break; // nothing is in use at all
+
+		retire_oldest_fence();
+	}
+
+	mHead_ = start + byteCount;
+
+	*offset = (size_t)(start % mCapacity_);
+	return mMapping_ + *offset;
+}
+
+void StreamingBuffer::fence()
+{
+	if (mHead_ == mFenced_) return; // nothing has been written since the last fence
+
+	mFences_.push_back({ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), mHead_ });
+	mFenced_ = mHead_;
+
+	// fences that have already signalled are let go without waiting, so the queue stays short
+	while (!mFences_.empty())
+	{
+		const GLenum status = glClientWaitSync(mFences_.front().sync, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+
+		glDeleteSync(mFences_.front().sync);
+		mRetired_ = mFences_.front().end;
+		mFences_.pop_front();
+	}
+}
+
+void StreamingBuffer::retire_oldest_fence()
+{
+	const Fence& oldest = mFences_.front();
+
+	// the first wait flushes, otherwise the fence might never reach the GPU
+	GLbitfield waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+	while (glClientWaitSync(oldest.sync, waitFlags, 1000000000) == GL_TIMEOUT_EXPIRED)
+	{
+		waitFlags = 0;
+	}
+
+	glDeleteSync(oldest.sync);
+	mRetired_ = oldest.end;
+	mFences_.pop_front();
+}
+
+void StreamingBuffer::release()
+{
+	for (const Fence& pending : mFences_)
+	{
+		glDeleteSync(pending.sync);
+	}
+	mFences_.clear();
+
+	if (mBuffer_ != 0)
+	{
+		glUnmapNamedBuffer(mBuffer_);
+		glDeleteBuffers(1, &mBuffer_);
+	}
+
+	mBuffer_ = 0;
+	mMapping_ = nullptr;
+	mCapacity_ = 0;
+}
+
+unsigned int StreamingBuffer::get_buffer() const
+{
+	return mBuffer_;
+}
+
+size_t StreamingBuffer::get_capacity() const
+{
+	return mCapacity_;
+}
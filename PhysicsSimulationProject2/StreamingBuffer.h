@@ -0,0 +1,56 @@
+#pragma once
+#include <deque>
+#include <cstddef>
+
+#include "glad/glad.h"
+
+/**
+ * \brief A ring of GPU-visible memory that stays mapped for the lifetime of the program. Data is written straight into the mapping and
+ * copied on the GPU into the buffer it belongs in, so an upload never reallocates storage or waits for the driver to synchronise with
+ * draws still reading the destination. Every region of the ring is guarded by a fence until the GPU has finished copying out of it
+ */
+class StreamingBuffer
+{
+public:
+	StreamingBuffer();
+	~StreamingBuffer();
+	StreamingBuffer(const StreamingBuffer&) = delete;
+	StreamingBuffer(StreamingBuffer&&) = delete;
+	StreamingBuffer& operator=(const StreamingBuffer&) = delete;
+	StreamingBuffer& operator=(StreamingBuffer&&) = delete;
+
+	void create(size_t capacity); // creates and maps the buffer, requires an OpenGL context
+
+	/**
+	 * \brief Takes room for the next write from the ring, waiting for the GPU to finish with the oldest regions if the ring is full
+	 * \param byteCount - at most the ring's capacity, larger uploads must be split
+	 * \param offset - set to where the room starts in get_buffer(), for the copy out of it
+	 * \return the mapped memory to write into, it is coherent so nothing needs to be flushed
+	 */
+	void* allocate(size_t byteCount, size_t* offset);
+
+	void fence(); // guards everything allocated since the last fence until the commands issued so far have finished, call after the copies are issued
+	void release(); // unmaps and frees the buffer, must be called before the context is destroyed
+
+	unsigned int get_buffer() const;
+	size_t get_capacity() const;
+
+private:
+	// Positions count every byte ever allocated, so a position is in the buffer at position % capacity and the ring never has to
+	// tell a full ring from an empty one
+	struct Fence
+	{
+		GLsync sync;
+		unsigned long long end; // every byte before this position is free once the fence has signalled
+	};
+
+	void retire_oldest_fence(); // waits for the oldest fence, which is usually signalled long before it is needed again
+
+	unsigned int mBuffer_;
+	unsigned char* mMapping_;
+	size_t mCapacity_;
+	unsigned long long mHead_; // where the next allocation starts
+	unsigned long long mFenced_; // everything before this position is guarded by a fence
+	unsigned long long mRetired_; // everything before this position can be written again
+	std::deque<Fence> mFences_;
+};
@@ -0,0 +1,169 @@
+#include "SurfaceShader.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include "GraphMesh.h"
+
+namespace
+{
+	// A float literal that reads back as exactly the same float, GLSL has no literals for infinity or nan so their bits are used instead
+	std::string glsl_float(float value)
+	{
+		char text[32];
+
+		if (!std::isfinite(value))
+		{
+			unsigned int bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			std::snprintf(text, sizeof(text), "uintBitsToFloat(0x%08xu)", bits);
+			return text;
+		}
+
+		std::snprintf(text, sizeof(text), "%.9g", value);
+
+		std::string literal = text;
+		if (literal.find_first_of(".e") == std::string::npos) literal += ".0"; // "2" would be an int
+		return literal;
+	}
+}
+
+SurfaceShader::SurfaceShader() :
+	mVao_(0),
+	mIsEmpty_(true),
+	mSampleSizeLocation_(-1),
+	mFirstRowLocation_(-1),
+	mFirstColumnLocation_(-1),
+	mSpacingLocation_(-1)
+{
+}
+
+SurfaceShader::~SurfaceShader()
+{
+	// GL objects cannot be deleted here, the context may already be gone, so release() must have been called
+	assert(mVao_ == 0);
+}
+
+/**
+ * \brief The stack of the program becomes one variable per stack slot, and every instruction becomes one line that reads and writes
+ * the slots it would pop and push. The GLSL compiler then keeps the whole calculation in registers
+ */
+std::string SurfaceShader::generate_function(const ExpressionProgram& program)
+{
+	assert(!program.is_empty() && program.get_row_programs().empty());
+
+	std::ostringstream source;
+	source << "vec3 graph_function(float x, float y)\n{\n";
+
+	for (int slot = 0; slot < program.get_stack_depth(); slot++)
+	{
+		source << "\tvec3 s" << slot << ";\n";
+	}
+
+	int top = -1;
+
+	for (const Instruction& instruction : program.get_instructions())
+	{
+		switch (instruction.opCode)
+		{
+		case OpCode::PushConstant:
+			top++;
+			source << "\ts" << top << " = vec3(" << glsl_float(instruction.constant) << ", 0.0, 0.0);\n";
+			break;
+		case OpCode::PushX:
+			top++;
+			source << "\ts" << top << " = vec3(x, 1.0, 0.0);\n";
+			break;
+		case OpCode::PushY:
+			top++;
+			source << "\ts" << top << " = vec3(y, 0.0, 1.0);\n";
+			break;
+		case OpCode::Add:
+			top--;
+			source << "\ts" << top << " = s" << top << " + s" << top + 1 << ";\n";
+			break;
+		case OpCode::Subtract:
+			top--;
+			source << "\ts" << top << " = s" << top << " - s" << top + 1 << ";\n";
+			break;
+		case OpCode::Multiply:
+			top--;
+			source << "\ts" << top << " = dual_multiply(s" << top << ", s" << top + 1 << ");\n";
+			break;
+		case OpCode::Divide:
+			top--;
+			source << "\ts" << top << " = dual_divide(s" << top << ", s" << top + 1 << ");\n";
+			break;
+		case OpCode::Power:
+			top--;
+			source << "\ts" << top << " = dual_power(s" << top << ", s" << top + 1 << ");\n";
+			break;
+		case OpCode::IntegerPower:
+			source << "\ts" << top << " = dual_integer_power(s" << top << ", " << instruction.operand << ");\n";
+			break;
+		case OpCode::PushRowValue: // ruled out above, row values are only worth calculating separately on the CPU
+			assert(false);
+			break;
+		}
+	}
+
+	source << "\treturn s0;\n}\n";
+	return source.str();
+}
+
+bool SurfaceShader::build(const ExpressionProgram& program, const std::string& vertexTemplate, unsigned int fragmentShader)
+{
+	const unsigned int vertexShader = ShaderProgram::compile_shader(GL_VERTEX_SHADER, vertexTemplate + "\n" + generate_function(program));
+	if (vertexShader == 0) return false;
+
+	const bool isLinked = mProgram_.link(vertexShader, fragmentShader);
+	glDeleteShader(vertexShader); // the program keeps what it needs
+
+	if (!isLinked) return false;
+
+	mIsEmpty_ = false;
+
+	if (mVao_ == 0) glGenVertexArrays(1, &mVao_); // a vertex array must be bound to draw, even one without attributes
+
+	mSampleSizeLocation_ = mProgram_.get_uniform_location("sampleSize");
+	mFirstRowLocation_ = mProgram_.get_uniform_location("firstRow");
+	mFirstColumnLocation_ = mProgram_.get_uniform_location("firstColumn");
+	mSpacingLocation_ = mProgram_.get_uniform_location("spacing");
+
+	return true;
+}
+
+void SurfaceShader::clear()
+{
+	mIsEmpty_ = true;
+}
+
+void SurfaceShader::draw(const GridWindow& window, unsigned int graphIndex) const
+{
+	if (mIsEmpty_) return;
+
+	mProgram_.use();
+	glUniform1i(mSampleSizeLocation_, window.sampleSize);
+	glUniform1i(mFirstRowLocation_, window.firstRow);
+	glUniform1i(mFirstColumnLocation_, window.firstColumn);
+	glUniform1f(mSpacingLocation_, window.spacing);
+
+	glBindVertexArray(mVao_);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, GraphMesh::get_grid_index_buffer(window.sampleSize)); // recorded by the vertex array
+	glDrawElementsInstancedBaseInstance(GL_TRIANGLES, GraphLogic::get_grid_index_count(window.sampleSize), GL_UNSIGNED_INT, 0, 1, graphIndex); // the shader reads the graph's index from gl_BaseInstance
+}
+
+void SurfaceShader::release()
+{
+	mProgram_.release();
+	if (mVao_ != 0) glDeleteVertexArrays(1, &mVao_);
+
+	mVao_ = 0;
+	mIsEmpty_ = true;
+}
+
+unsigned int SurfaceShader::get_program() const
+{
+	return mProgram_.get_id();
+}
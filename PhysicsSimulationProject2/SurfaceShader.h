@@ -0,0 +1,66 @@
+#pragma once
+#include <string>
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+#include "ExpressionProgram.h"
+#include "GraphLogic.h"
+#include "ShaderProgram.h"
+
+/**
+ * \brief Evaluates a graph on the GPU instead of sampling it on the CPU. The expression is translated into GLSL and compiled into the graph's
+ * vertex shader, which places every vertex of a flat grid from its index and raises it to the height of the surface. The grid is drawn with
+ * the index buffers GraphMesh shares between graphs and has no vertex data, so editing a graph only recompiles a small shader, and moving
+ * the domain or changing the resolution only changes uniforms
+ */
+class SurfaceShader
+{
+public:
+	SurfaceShader();
+	~SurfaceShader();
+	SurfaceShader(const SurfaceShader&) = delete;
+	SurfaceShader(SurfaceShader&&) = delete;
+	SurfaceShader& operator=(const SurfaceShader&) = delete;
+	SurfaceShader& operator=(SurfaceShader&&) = delete;
+
+	/**
+	 * \brief Translates a program into the GLSL function graph_function(x, y), which returns the height and its derivatives with respect to x and y.
+	 * Needs no OpenGL context
+	 * \param program - a program that is not empty and has no row programs, i.e. optimised without hoisting row invariants
+	 */
+	static std::string generate_function(const ExpressionProgram& program);
+
+	/**
+	 * \brief Compiles a graph's expression into the shader, requires an OpenGL context
+	 * \param program - as for generate_function
+	 * \param vertexTemplate - the contents of surface_vertex_shader.txt
+	 * \param fragmentShader - a compiled fragment shader object, it can be shared by every graph
+	 * \return false if the shader could not be compiled or linked, in which case the previous expression is kept
+	 */
+	bool build(const ExpressionProgram& program, const std::string& vertexTemplate, unsigned int fragmentShader);
+
+	void clear(); // the graph is no longer drawn, the shader is kept for the next expression
+
+	/**
+	 * \brief Draws the graph over the window's lattice points, binds the shader and leaves it bound
+	 * \param window - the points to draw, the graph is never sampled so any window can be drawn without rebuilding it
+	 * \param graphIndex - the graph's index in the Scene block, which picks its model matrix and colour, see SceneUniforms
+	 */
+	void draw(const GridWindow& window, unsigned int graphIndex) const;
+
+	void release(); // frees every GL object owned by the shader, must be called before the context is destroyed
+
+	unsigned int get_program() const; // 0 if nothing has been built
+
+private:
+	ShaderProgram mProgram_;
+	unsigned int mVao_; // has no attributes, it only records the grid's index buffer
+	bool mIsEmpty_;
+
+	// looked up once when the program is linked, the rest of the graph's state is in the Scene block
+	int mSampleSizeLocation_;
+	int mFirstRowLocation_;
+	int mFirstColumnLocation_;
+	int mSpacingLocation_;
+};
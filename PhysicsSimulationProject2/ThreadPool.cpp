@@ -0,0 +1,116 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int workerCount) :
+	mTask_(nullptr),
+	mTaskCount_(0),
+	mJobNumber_(0),
+	mActiveWorkers_(0),
+	mIsShuttingDown_(false),
+	mNextTask_(0),
+	mTasksRemaining_(0)
+{
+	mWorkers_.reserve(workerCount);
+	for (unsigned int i = 0; i < workerCount; i++)
+	{
+		mWorkers_.emplace_back(&ThreadPool::worker_loop, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex_);
+		mIsShuttingDown_ = true;
+	}
+	mWorkAvailable_.notify_all();
+
+	for (std::thread& worker : mWorkers_)
+	{
+		worker.join();
+	}
+}
+
+ThreadPool& ThreadPool::get_shared_pool()
+{
+	// The calling thread also does work, so one less worker than there are cores is needed
+	static ThreadPool pool(std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 0);
+	return pool;
+}
+
+unsigned int ThreadPool::get_thread_count() const
+{
+	return (unsigned int)mWorkers_.size() + 1;
+}
+
+void ThreadPool::parallel_for(int taskCount, const std::function<void(int)>& task)
+{
+	if (taskCount <= 0) return;
+
+	if (taskCount == 1 || mWorkers_.empty()) // waking the workers would cost more than the work itself
+	{
+		for (int i = 0; i < taskCount; i++) task(i);
+		return;
+	}
+
+	std::lock_guard<std::mutex> submitLock(mSubmitMutex_);
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex_);
+		mTask_ = &task;
+		mTaskCount_ = taskCount;
+		mNextTask_ = 0;
+		mTasksRemaining_ = taskCount;
+		mJobNumber_++;
+	}
+	mWorkAvailable_.notify_all();
+
+	run_tasks(); // the calling thread helps rather than sitting idle
+
+	// We also wait for the workers to leave the job, so none of them can still be holding a pointer to task after we return
+	std::unique_lock<std::mutex> lock(mMutex_);
+	mWorkFinished_.wait(lock, [this]() { return mTasksRemaining_ == 0 && mActiveWorkers_ == 0; });
+	mTask_ = nullptr;
+}
+
+void ThreadPool::run_tasks()
+{
+	while (true)
+	{
+		const int taskIndex = mNextTask_.fetch_add(1);
+		if (taskIndex >= mTaskCount_) return;
+
+		(*mTask_)(taskIndex);
+
+		if (mTasksRemaining_.fetch_sub(1) == 1) // this was the last task to finish
+		{
+			std::lock_guard<std::mutex> lock(mMutex_);
+			mWorkFinished_.notify_all();
+		}
+	}
+}
+
+void ThreadPool::worker_loop()
+{
+	unsigned long long lastJob = 0;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mMutex_);
+			mWorkAvailable_.wait(lock, [&]() { return mIsShuttingDown_ || (mJobNumber_ != lastJob && mTask_ != nullptr); });
+
+			if (mIsShuttingDown_) return;
+
+			lastJob = mJobNumber_;
+			mActiveWorkers_++;
+		}
+
+		run_tasks();
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex_);
+			mActiveWorkers_--;
+		}
+		mWorkFinished_.notify_all();
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+/**
+ * \brief A fixed set of worker threads that are created once and then reused, so that splitting work across the CPU
+ * does not pay for creating and destroying threads every time
+ */
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned int workerCount);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool(ThreadPool&&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	ThreadPool& operator=(ThreadPool&&) = delete;
+
+	/**
+	 * \brief Calls task(i) once for every i from 0 to taskCount - 1, spread across the workers and the calling thread
+	 * \param taskCount - the number of independent pieces of work
+	 * \param task - must be safe to call from several threads at once
+	 * Returns once every task has finished
+	 */
+	void parallel_for(int taskCount, const std::function<void(int)>& task);
+
+	unsigned int get_thread_count() const; // the number of threads that work on a parallel_for, including the caller
+
+	static ThreadPool& get_shared_pool(); // a pool with one thread per CPU core, created the first time it is needed
+
+private:
+	void worker_loop();
+	void run_tasks(); // takes tasks from the current job until none are left
+
+	std::vector<std::thread> mWorkers_;
+
+	std::mutex mSubmitMutex_; // only one parallel_for can use the workers at a time
+	std::mutex mMutex_;
+	std::condition_variable mWorkAvailable_;
+	std::condition_variable mWorkFinished_;
+
+	// the current job, written while holding mMutex_
+	const std::function<void(int)>* mTask_;
+	int mTaskCount_;
+	unsigned long long mJobNumber_; // incremented for every job, so that workers can tell a new job apart from one they have already done
+	int mActiveWorkers_; // the number of workers currently running tasks from the job
+	bool mIsShuttingDown_;
+
+	std::atomic<int> mNextTask_;
+	std::atomic<int> mTasksRemaining_;
+};
@@ -16,12 +16,18 @@
 #include <sstream>
 #include <utility>
 #include <array>
+#include <cmath>
+#include <cstdlib>
 #include <fstream>
 
 #include "vector.h"
 #include "GraphLogic.h"
 
 #include "InputHandler.h"
+#include "GraphRebuilder.h"
+#include "GraphMesh.h"
+#include "SurfaceShader.h"
+#include "ShaderProgram.h"
 
 // GLOBAL VARIABLES, const because they will never change 
 static const unsigned int height = 600;
@@ -32,9 +38,21 @@ static const unsigned int fps = 144;
 
 static bool shouldDisplaySettings = false; 
 static bool shouldSaveOnExit = true; 
-static unsigned int performanceSetting = 3; 
+static int defaultSampleSize = 80; // the number of samples along each axis given to every graph by the graphics settings 
+static SamplingMode samplingMode = SamplingMode::Grid; // how the points of every graph are chosen 
+static bool useLitSurfaces = false; // draw the graphs as filled surfaces shaded using their normals, instead of as wireframes 
+static bool useGpuEvaluation = false; // every graph is calculated in its vertex shader instead of being sampled on the CPU, see SurfaceShader 
+static GraphDomain graphDomain = { 0.f, 0.f, 0 }; // the part of the plane that every graph is sampled over, moved with the arrow and page keys 
+
+// Everything the render loop needs to know about one graph 
+struct GraphSlot
+{
+	SurfaceShader surface; // draws the graph instead of the mesh when graphs are evaluated on the GPU 
+	int sampleSize; // the number of samples along each axis, graphs can be given different resolutions 
+};
 
-static std::array<unsigned int, 10> functionVertexArrayObjects; 
+static std::array<GraphSlot, SceneUniforms::maxGraphs> graphSlots; 
+static GraphMesh graphMeshes(SceneUniforms::maxGraphs); // every sampled graph's mesh, owns their GL objects for the whole lifetime of the program 
 
 GLFWwindow* window_init(); // declaring our function signature 
 
@@ -77,40 +95,113 @@ void graph_helper_marker_and_icon(int index)
 
 
 /**
- * \brief Update the vertex array object of a specific graph 
- * \param i The index of the VBO being updated 
- * \param userInput given in infix form. This input has NOT been validated 
+ * \brief Update the mesh of a specific graph, this is the only part of a rebuild that runs on the main thread 
+ * \param graphData The mesh that was sampled in the background by the GraphRebuilder 
  */
-void update_current_function_data(unsigned int i, std::string userInput)
+void update_current_function_data(const GraphMeshData& graphData)
 {
-	bool errorFlag = false; // The error flag is originally set to false
+	// The graph's existing buffers are reused, so editing a graph never allocates new GL objects 
+	if (graphData.firstRow >= 0)
+	{
+		graphMeshes.upload_rows(graphData.slot, graphData.vertices, graphData.window, graphData.firstRow); // a chunk of a very large grid, drawn as soon as it arrives 
+	}
+	else if (graphData.indices.empty())
+	{
+		graphMeshes.upload(graphData.slot, graphData.vertices, graphData.window); // a regular grid, which uses the shared indices 
+	}
+	else
+	{
+		graphMeshes.upload(graphData.slot, graphData.vertices, graphData.indices); 
+	}
+}
 
-	std::vector<std::string> postfixExpression = InputHandler::verify_and_convert_function(userInput, &errorFlag); 
+/**
+ * \brief Compiles a graph's expression into its vertex shader, this replaces the GraphRebuilder when graphs are evaluated on the GPU. 
+ * Parsing takes microseconds and only a small shader is compiled, so it runs on the main thread 
+ * \param input - the text the user entered, the graph keeps its previous expression if it is invalid 
+ * \param vertexTemplate - the contents of surface_vertex_shader.txt 
+ * \param fragmentShader - the fragment shader every graph is drawn with 
+ */
+void build_graph_shader(GraphSlot& slot, const char* input, const std::string& vertexTemplate, unsigned int fragmentShader)
+{
+	static std::vector<Token> postfixExpression; // reused by every edit 
 
-	if (errorFlag) return; // The program should not update the VAO if the graph provided by the user is INVALID
+	bool errorFlag = false; 
+	InputHandler::verify_and_convert_function(input, &postfixExpression, &errorFlag); 
 
-	glBindVertexArray(functionVertexArrayObjects[i]); // binding the vertex array object to the openGL context
+	const ExpressionProgram program = errorFlag ? ExpressionProgram() : ExpressionProgram::compile(postfixExpression, &errorFlag); 
+	if (errorFlag) return; 
+
+	if (program.is_empty()) // the user cleared the graph 
+	{
+		slot.surface.clear(); 
+		return; 
+	}
 
-	std::pair<std::vector<glm::vec3>, std::vector<unsigned int>> graphData = GraphLogic::sample_points(postfixExpression, performanceSetting); 
+	// Row values are calculated once per row of samples on the CPU, on the GPU every vertex is calculated on its own so they would gain nothing 
+	slot.surface.build(ExpressionOptimiser::optimise(program, false), vertexTemplate, fragmentShader); 
+}
+
+/**
+ * \brief The graphs are sampled at their true coordinates, so the domain is moved back to the origin and scaled to the same size on screen at every zoom level 
+ */
+glm::mat4 domain_model_matrix(const GraphDomain& domain)
+{
+	const glm::mat4 scale = glm::scale(glm::mat4(1.f), glm::vec3(std::ldexp(1.f, -domain.zoomLevel))); 
+	return glm::translate(scale, glm::vec3(-domain.centreX, 0.f, -domain.centreY)); // the graph's y axis is drawn along world z 
+}
+
+#ifdef GRAPH_SOAK_TEST
+/**
+ * \brief Edits every graph 10,000 times in a row, cycling through expressions and resolutions, and checks that the GL buffer memory stops growing 
+ * Build with GRAPH_SOAK_TEST defined to run it at start up, the result is checked without assert so Release builds fail too 
+ * \return true if every expression compiled and no memory was allocated after the first round of edits 
+ */
+bool run_buffer_soak_test()
+{
+	const std::array<const char*, 4> expressions = { "x^2 + y^2", "1/x", "2xy - y^3", "x" };
+	const std::array<int, 4> sampleSizes = { 80, 20, 160, 40 };
+
+	// Every graph and every grid's indices are first given room at their largest size, after which no edit should need any more memory 
+	for (int sampleSize : sampleSizes)
+	{
+		for (int i = 0; i < SceneUniforms::maxGraphs; i++)
+		{
+			graphMeshes.upload(i, std::vector<GraphVertex>(sampleSize * sampleSize), GraphLogic::get_grid_window({ 0.f, 0.f, 0 }, sampleSize)); 
+		}
+	}
+	const long long bytesAtLargestSize = GraphMesh::get_live_buffer_bytes(); 
 
-	unsigned int vbo; // vbo = vertex buffer object 
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo); // Binding our vertex buffer to the vertex array object 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * graphData.first.size(), graphData.first.data(), GL_STATIC_DRAW); // preparing our vertex data that will be sent to the GPU
+	std::vector<Token> postfixExpression; 
 
-	unsigned int ebo; // ebo = element buffer object
-	glGenBuffers(1, &ebo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * graphData.second.size(), graphData.second.data(), GL_STATIC_DRAW); // preparing data to send to GPU
+	for (int edit = 0; edit < 10000; edit++)
+	{
+		bool errorFlag = false; 
+		InputHandler::verify_and_convert_function(expressions[edit % 4], &postfixExpression, &errorFlag); 
+		ExpressionProgram program = ExpressionProgram::compile(postfixExpression, &errorFlag); 
+		if (errorFlag)
+		{
+			std::cout << "Soak test FAIL: could not compile " << expressions[edit % 4] << std::endl; 
+			return false; 
+		}
 
-	std::cout << "Size of EBO: " <<  graphData.second.size() << std::endl;
+		const int sampleSize = sampleSizes[(edit / 4) % 4]; 
+		graphMeshes.upload(edit % 10, GraphLogic::sample_points(program, sampleSize), GraphLogic::get_grid_window({ 0.f, 0.f, 0 }, sampleSize)); 
 
+		if ((edit + 1) % 1000 == 0)
+		{
+			std::cout << "Soak test: " << edit + 1 << " edits, live GL buffer bytes: " << GraphMesh::get_live_buffer_bytes() << std::endl; 
+		}
+	}
 
-	// The GPU is given a stream of data but does not know how to deal with it
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GL_FLOAT) * 3, (void*)0); //  SEPCIFY sizeof(GL_FLOAT) * 3 because we are not sent additional texture data or normal vector data
+	// any growth after the first round would be a leak 
+	const long long bytesAfterEdits = GraphMesh::get_live_buffer_bytes(); 
+	const bool isPassed = bytesAfterEdits == bytesAtLargestSize; 
 
-	glEnableVertexAttribArray(0); 
+	std::cout << "Soak test " << (isPassed ? "PASS" : "FAIL") << ": " << bytesAtLargestSize << " bytes before the edits, " << bytesAfterEdits << " bytes after" << std::endl; 
+	return isPassed; 
 }
+#endif
 
 char main()
 {
@@ -136,12 +227,10 @@ char main()
 	std::string vertexShaderString;
 	std::string fragmentShaderString; 
 
-	// Shaders require their code as a cString
-	// Here we from our shader files and convert the text inside them into a cString
+	// Here we read our shader files into strings 
 	inFile.open("vertex_shader.txt");  
 	stream << inFile.rdbuf(); // reading the vertex_shader.txt file into our string stream 
 	vertexShaderString = stream.str(); // reading the string stream into our vertexShaderString Object 
-	const char* vertexShaderCString = vertexShaderString.c_str(); 
 	stream.str(""); 
 	inFile.close(); 
 
@@ -149,65 +238,71 @@ char main()
 	inFile.open("fragment_shader.txt");
 	stream << inFile.rdbuf();
 	fragmentShaderString = stream.str();
-	const char* fragmentShaderCString = fragmentShaderString.c_str(); 
+	stream.str(""); 
+	inFile.close(); 
 
+	// Used in place of vertex_shader.txt when graphs are evaluated on the GPU, every graph adds its own expression to it 
+	inFile.open("surface_vertex_shader.txt");
+	stream << inFile.rdbuf();
+	const std::string surfaceShaderTemplate = stream.str(); 
+	stream.str(""); 
+	inFile.close(); 
 
-	unsigned int vertexShaderObject = glCreateShader(GL_VERTEX_SHADER); // creating a Shader object 
-	glShaderSource(vertexShaderObject, 1, &vertexShaderCString, NULL); // passing our cString into our shader Object 
-	glCompileShader(vertexShaderObject); // compiling our shader 
+	// Used in place of vertex_shader.txt for grid meshes, whose vertices are packed, see GraphMesh 
+	inFile.open("grid_vertex_shader.txt");
+	stream << inFile.rdbuf();
+	const std::string gridVertexShaderString = stream.str(); 
+	inFile.close(); 
 
-	int success; 
-	char log[512];
 
-	// checking shader compilation status 
-	glGetShaderiv(vertexShaderObject, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		glGetShaderInfoLog(vertexShaderObject, 512, NULL, log);
-		std::cout << log << std::endl; 
-	}
+	// compiling our shaders, any errors are printed to the console 
+	const unsigned int vertexShaderObject = ShaderProgram::compile_shader(GL_VERTEX_SHADER, vertexShaderString); 
+	const unsigned int gridVertexShaderObject = ShaderProgram::compile_shader(GL_VERTEX_SHADER, gridVertexShaderString); 
+	const unsigned int fragmentShaderObject = ShaderProgram::compile_shader(GL_FRAGMENT_SHADER, fragmentShaderString); // kept for the shaders of graphs evaluated on the GPU 
+
+	// linking and using Shader Program 
+	ShaderProgram shaderProgram; 
+	shaderProgram.link(vertexShaderObject, fragmentShaderObject); 
+	shaderProgram.use(); 
+	glDeleteShader(vertexShaderObject); 
 
-	// The same needs to be done for the fragment shader 
+	ShaderProgram gridShaderProgram; // draws every grid mesh 
+	gridShaderProgram.link(gridVertexShaderObject, fragmentShaderObject); 
+	glDeleteShader(gridVertexShaderObject); 
 
-	unsigned int fragmentShaderObject = glCreateShader(GL_FRAGMENT_SHADER); 
-	glShaderSource(fragmentShaderObject, 1, &fragmentShaderCString, NULL);
-	glCompileShader(fragmentShaderObject);
+	// Everything the shaders share is written to one uniform buffer once per frame, instead of being set uniform by uniform before every draw 
+	SceneUniforms scene = {}; 
+	const unsigned int sceneBuffer = ShaderProgram::create_scene_buffer(); 
 
-	glGetShaderiv(fragmentShaderObject, GL_COMPILE_STATUS, &success);
-	if (!success)
+	for (int i = 0; i < SceneUniforms::maxGraphs; i++)
 	{
-		glGetShaderInfoLog(fragmentShaderObject, 512, NULL, log);
-		std::cout << log << std::endl;
+		// the same colour as the graph's label, see graph_helper_marker_and_icon 
+		float t = (i + 1) / 9.f;
+		scene.colours[i] = { pow(1 - t, 2), 2 * (1 - t) * t, pow(t, 2), 1.f };
 	}
 
-	// creating, linking and using Shader Program 
-
-	unsigned int shaderProgram = glCreateProgram();
-	glAttachShader(shaderProgram, vertexShaderObject);
-	glAttachShader(shaderProgram, fragmentShaderObject);
-	glLinkProgram(shaderProgram);
-	glUseProgram(shaderProgram);
-
-	for (unsigned int& vaoId : functionVertexArrayObjects) // getting the reference 
+	for (GraphSlot& slot : graphSlots) // getting the reference 
 	{
-		glGenVertexArrays(1, &vaoId); 
+		slot.sampleSize = defaultSampleSize; 
 	}
 
+#ifdef GRAPH_SOAK_TEST
+	if (!run_buffer_soak_test()) std::abort(); 
+#endif
+
 	//
 	Camera camera(glm::vec3(0.f, 0.f, 3.f), 0.f, -90.f);
 	InputHandler inputHandler; 
+	GraphRebuilder graphRebuilder; // parses and samples graphs in the background so that typing never stalls a frame 
 
 	// Matrices and Cameras
 	
 //	glm::mat4 model = glm::rotate(glm::mat4(1.f), glm::radians(-55.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-	glm::mat4 model = glm::mat4(1.f); 
+	glm::mat4 model = domain_model_matrix(graphDomain); 
 
 	glm::mat4 view = camera.get_view_matrix();
 	glm::mat4 projection = glm::perspective(glm::radians(65.f), width / (float)height, 0.1f, 100.f); 
 
-	glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-	glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-	glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection)); 
 
 	char** buffArr = new char*[10];
 	for (int i = 0; i < 10; i++)
@@ -216,6 +311,19 @@ char main()
 		std::fill(buffArr[i], buffArr[i] + 256, NULL); 
 	}
 
+	// Every graph is given its expression through here, it is compiled into the graph's shader on the GPU path and sampled in the background otherwise 
+	auto rebuild_graph = [&](int i)
+	{
+		if (useGpuEvaluation)
+		{
+			build_graph_shader(graphSlots[i], buffArr[i], surfaceShaderTemplate, fragmentShaderObject); 
+		}
+		else
+		{
+			graphRebuilder.request_rebuild(i, buffArr[i], graphSlots[i].sampleSize, samplingMode, graphDomain, { model, view, projection, (float)height });
+		}
+	};
+
 	std::ifstream inputFile;
 	inputFile.open("SavedGraphs.txt", std::fstream::app); // automatically creates the file if it is not already created 
 
@@ -232,7 +340,7 @@ char main()
 			assert(i <= 9); // abort() incase we are trying to do an illegal access of an array
 
 			strcpy_s(buffArr[i], sizeof(char) * 256, equation.c_str()); // we do a safe string copy
-			update_current_function_data(i, equation);
+			rebuild_graph(i);
 		}
 	}
 
@@ -248,41 +356,70 @@ char main()
 			//std::cout << "FPS: " << 1 / deltaTime << std::endl;
 
 			inputHandler.handle_glfw_input(window, camera, deltaTime);
+			const glm::mat4 previousView = view; 
 			view = camera.get_view_matrix();
-			glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+
+			// the detail of a view dependent graph follows the camera, a graph still being sampled is left to finish first 
+			if (samplingMode == SamplingMode::ViewDependent && !useGpuEvaluation && view != previousView)
+			{
+				for (int i = 0; i < 10; i++)
+				{
+					rebuild_graph(i);
+				}
+			}
+
+			// the arrow keys also move the cursor in a text box, so the domain only moves while no text box is being typed in 
+			if (!io.WantCaptureKeyboard && inputHandler.handle_domain_input(window, graphDomain, deltaTime))
+			{
+				model = domain_model_matrix(graphDomain);
+
+				// only the newly exposed samples of each grid are evaluated, see GridSampleCache. A graph evaluated on the GPU follows the domain by itself 
+				for (int i = 0; i < 10 && !useGpuEvaluation; i++)
+				{
+					rebuild_graph(i);
+				}
+			}
 
 			lastFrame = currentFrame; 
 		}
 
+		// Meshes that finished sampling in the background are uploaded here, until then the old mesh keeps being drawn 
+		for (const GraphMeshData& graphData : graphRebuilder.take_finished_meshes())
+		{
+			update_current_function_data(graphData);
+		}
+
 		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); 
 
 		glEnable(GL_DEPTH_TEST); 
 
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); 
+		glPolygonMode(GL_FRONT_AND_BACK, useLitSurfaces ? GL_FILL : GL_LINE); 
 
-		for (unsigned int vao : functionVertexArrayObjects)
-		{
-			glBindVertexArray(vao); // bind the desired VAO to the OpenGL context
+		// the whole frame's shared state in one upload, every graph then picks its own model matrix and colour by its index 
+		scene.view = view; 
+		scene.projection = projection; 
+		std::fill(scene.models, scene.models + SceneUniforms::maxGraphs, model); // the graphs share one domain 
+		scene.isLit = useLitSurfaces; 
+		ShaderProgram::update_scene_buffer(sceneBuffer, scene); 
 
-			float t = vao / 9.f;
-			glm::vec3 colour = { pow(1 - t, 2), 2 * (1 - t) * t,  pow(t, 2) };
-
-			glUniform3fv(glGetUniformLocation(shaderProgram, "graphColor"), 1, glm::value_ptr(colour)); 
-
-			int triangleCount = 0; 
-			if (performanceSetting == 3)
-			{
-				triangleCount = 37446; 
-			}
-			if (performanceSetting == 1)
+		std::vector<int> drawnSampleSizes; 
+		if (useGpuEvaluation)
+		{
+			for (unsigned int i = 0; i < graphSlots.size(); i++)
 			{
-				triangleCount = 2166; 
+				const int sampleSize = GraphLogic::clamp_sample_size(graphSlots[i].sampleSize); 
+				graphSlots[i].surface.draw(GraphLogic::get_grid_window(graphDomain, sampleSize), i); 
+				drawnSampleSizes.push_back(sampleSize); 
 			}
-
-			glDrawElements(GL_TRIANGLES, 37446, GL_UNSIGNED_INT, 0);
+			shaderProgram.use(); // every graph's shader binds itself 
 		}
+		else
+		{
+			graphMeshes.draw(gridShaderProgram, shaderProgram); // every graph with a mesh in one call for each kind of mesh 
+		}
+		GraphMesh::release_unused_shared_buffers(drawnSampleSizes); // only the resolutions drawn this frame keep their index buffers 
 
 		// IMGUI new frame 
 
@@ -315,25 +452,25 @@ char main()
 			ImGui::PopID();
 		}*/
 
-		if (ImGui::InputTextWithHint("##text1", "Graph 1", buffArr[0], sizeof(char) * 256, textFlags)) update_current_function_data(0, buffArr[0]);
+		if (ImGui::InputTextWithHint("##text1", "Graph 1", buffArr[0], sizeof(char) * 256, textFlags)) rebuild_graph(0);
 		graph_helper_marker_and_icon(1); 
-		if (ImGui::InputTextWithHint("##text2", "Graph 2", buffArr[1], sizeof(char) * 256, textFlags)) update_current_function_data(1, buffArr[1]);
+		if (ImGui::InputTextWithHint("##text2", "Graph 2", buffArr[1], sizeof(char) * 256, textFlags)) rebuild_graph(1);
 		graph_helper_marker_and_icon(2);
-		if (ImGui::InputTextWithHint("##text3", "Graph 3", buffArr[2], sizeof(char) * 256, textFlags)) update_current_function_data(2, buffArr[2]);
+		if (ImGui::InputTextWithHint("##text3", "Graph 3", buffArr[2], sizeof(char) * 256, textFlags)) rebuild_graph(2);
 		graph_helper_marker_and_icon(3);
-		if (ImGui::InputTextWithHint("##text4", "Graph 4", buffArr[3], sizeof(char) * 256, textFlags)) update_current_function_data(3, buffArr[3]);
+		if (ImGui::InputTextWithHint("##text4", "Graph 4", buffArr[3], sizeof(char) * 256, textFlags)) rebuild_graph(3);
 		graph_helper_marker_and_icon(4);
-		if (ImGui::InputTextWithHint("##text5", "Graph 5", buffArr[4], sizeof(char) * 256, textFlags)) update_current_function_data(4, buffArr[4]);
+		if (ImGui::InputTextWithHint("##text5", "Graph 5", buffArr[4], sizeof(char) * 256, textFlags)) rebuild_graph(4);
 		graph_helper_marker_and_icon(5);
-		if (ImGui::InputTextWithHint("##text6", "Graph 6", buffArr[5], sizeof(char) * 256, textFlags)) update_current_function_data(5, buffArr[5]);
+		if (ImGui::InputTextWithHint("##text6", "Graph 6", buffArr[5], sizeof(char) * 256, textFlags)) rebuild_graph(5);
 		graph_helper_marker_and_icon(6);
-		if (ImGui::InputTextWithHint("##text7", "Graph 7", buffArr[6], sizeof(char) * 256, textFlags)) update_current_function_data(6, buffArr[6]);
+		if (ImGui::InputTextWithHint("##text7", "Graph 7", buffArr[6], sizeof(char) * 256, textFlags)) rebuild_graph(6);
 		graph_helper_marker_and_icon(7);
-		if (ImGui::InputTextWithHint("##text8", "Graph 8", buffArr[7], sizeof(char) * 256, textFlags)) update_current_function_data(7, buffArr[7]);
+		if (ImGui::InputTextWithHint("##text8", "Graph 8", buffArr[7], sizeof(char) * 256, textFlags)) rebuild_graph(7);
 		graph_helper_marker_and_icon(8);
-		if (ImGui::InputTextWithHint("##text9", "Graph 9", buffArr[8], sizeof(char) * 256, textFlags)) update_current_function_data(8, buffArr[8]);
+		if (ImGui::InputTextWithHint("##text9", "Graph 9", buffArr[8], sizeof(char) * 256, textFlags)) rebuild_graph(8);
 		graph_helper_marker_and_icon(9);
-		if (ImGui::InputTextWithHint("##text10", "Graph 10", buffArr[9], sizeof(char) * 256, textFlags)) update_current_function_data(9, buffArr[9]);
+		if (ImGui::InputTextWithHint("##text10", "Graph 10", buffArr[9], sizeof(char) * 256, textFlags)) rebuild_graph(9);
 		graph_helper_marker_and_icon(10);
 
 		if (ImGui::Button("Settings", ImVec2(80, 45)))
@@ -349,26 +486,115 @@ char main()
 			{
 				static int x = 0; // we need a way to link the radio buttons together, this is done through x 
 
+				bool resolutionChanged = false; 
+
 				if (ImGui::RadioButton("High", &x, 0)) // Radio button ensures that only one button can be pressed at a time 
 				{
-					performanceSetting = 3; 
+					defaultSampleSize = 80; 
+					resolutionChanged = true; 
 				};
 				ImGui::SameLine();
 				help_marker("Only recommended for high performance computers"); // writing an aid for the user 
 
 				if (ImGui::RadioButton("Medium", &x, 1))
 				{
-					performanceSetting = 2; 
+					defaultSampleSize = 40; 
+					resolutionChanged = true; 
 				}
 				ImGui::SameLine();
 				help_marker("The recommended setting"); // writing an aid for the user 
 
 				if (ImGui::RadioButton("Low", &x, 2))
 				{
-					performanceSetting = 1; 
+					defaultSampleSize = 20; 
+					resolutionChanged = true; 
 				}
 				ImGui::SameLine();
 				help_marker("Setting Recommended if the application is lagging"); // writing an aid for the user 
+
+				ImGui::RadioButton("Custom", &x, 3); 
+				if (ImGui::SliderInt("Samples per axis", &defaultSampleSize, GraphLogic::minSampleSize, GraphLogic::maxSampleSize, "%d", ImGuiSliderFlags_AlwaysClamp)) 
+				{
+					x = 3; // the resolution no longer matches one of the presets 
+					resolutionChanged = true; 
+				}
+				ImGui::SameLine();
+				help_marker("Very high values are intended for presentation renders"); // writing an aid for the user 
+
+				int mode = (int)samplingMode; 
+				ImGui::Text("Sampling"); 
+				if (ImGui::RadioButton("Grid", &mode, (int)SamplingMode::Grid)) resolutionChanged = true; 
+				ImGui::SameLine();
+				if (ImGui::RadioButton("Adaptive", &mode, (int)SamplingMode::Adaptive)) resolutionChanged = true; 
+				ImGui::SameLine();
+				help_marker("Only adds samples where the surface bends sharply, giving the detail of a very dense grid for far fewer samples"); // writing an aid for the user 
+				ImGui::SameLine();
+				if (ImGui::RadioButton("View dependent", &mode, (int)SamplingMode::ViewDependent)) resolutionChanged = true; 
+				ImGui::SameLine();
+				help_marker("Samples the parts of each graph near the camera at the full resolution and distant or hidden parts more coarsely, resampling as the camera moves"); // writing an aid for the user 
+				samplingMode = (SamplingMode)mode; 
+
+				ImGui::Checkbox("Filled, lit surfaces", &useLitSurfaces); // every mesh already has normals, so nothing needs to be rebuilt 
+				ImGui::SameLine();
+				help_marker("Draws the graphs as solid surfaces shaded by a light, instead of as wireframes"); // writing an aid for the user 
+
+				const bool evaluationChanged = ImGui::Checkbox("Evaluate on the GPU", &useGpuEvaluation); 
+				ImGui::SameLine();
+				help_marker("Calculates every graph in its vertex shader instead of sampling it, so moving the domain or changing the resolution needs no sampling at all. Graphs are always drawn as grids"); // writing an aid for the user 
+
+				if (resolutionChanged) // every graph is given the new resolution 
+				{
+					for (int i = 0; i < 10; i++)
+					{
+						graphSlots[i].sampleSize = defaultSampleSize; 
+						if (!useGpuEvaluation) rebuild_graph(i); // a graph evaluated on the GPU is drawn at any resolution without being rebuilt 
+					}
+				}
+
+				if (evaluationChanged) // every graph is rebuilt on the path it has been moved to 
+				{
+					for (int i = 0; i < 10; i++)
+					{
+						rebuild_graph(i); 
+					}
+				}
+
+				if (ImGui::TreeNode("Per graph resolution"))
+				{
+					for (int i = 0; i < 10; i++)
+					{
+						std::string label = "Graph " + std::to_string(i + 1); 
+						if (ImGui::SliderInt(label.c_str(), &graphSlots[i].sampleSize, GraphLogic::minSampleSize, GraphLogic::maxSampleSize, "%d", ImGuiSliderFlags_AlwaysClamp) && !useGpuEvaluation)
+						{
+							rebuild_graph(i);
+						}
+					}
+					ImGui::TreePop(); 
+				}
+			}
+
+			if (ImGui::CollapsingHeader("Domain"))
+			{
+				ImGui::Text("Centre: (%.3f, %.3f)", graphDomain.centreX, graphDomain.centreY); 
+				ImGui::Text("Width: %g", std::ldexp(GraphLogic::domainWidth, graphDomain.zoomLevel)); 
+				ImGui::SameLine();
+				help_marker("The arrow keys move the graphs and Page Up / Page Down zoom in and out, only the newly uncovered part of each graph is sampled"); // writing an aid for the user 
+
+				if (ImGui::Button("Reset domain"))
+				{
+					graphDomain = { 0.f, 0.f, 0 }; 
+					model = domain_model_matrix(graphDomain);
+
+					for (int i = 0; i < 10 && !useGpuEvaluation; i++)
+					{
+						rebuild_graph(i);
+					}
+				}
+			}
+
+			if (ImGui::CollapsingHeader("Debug"))
+			{
+				ImGui::Text("Live GL buffer memory: %lld bytes", GraphMesh::get_live_buffer_bytes()); 
 			}
 
 			if (ImGui::Button("Close Settings"))
@@ -413,6 +639,18 @@ char main()
 
 	exit(); 
 
+	// Every GL buffer is freed while the context still exists 
+	graphMeshes.release(); 
+	for (GraphSlot& slot : graphSlots)
+	{
+		slot.surface.release(); 
+	}
+	GraphMesh::release_shared_buffers(); 
+	shaderProgram.release(); 
+	gridShaderProgram.release(); 
+	glDeleteShader(fragmentShaderObject); 
+	glDeleteBuffers(1, &sceneBuffer); 
+
 	glfwTerminate();
 	return 0; 
 }
@@ -0,0 +1,198 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <cstdlib>
+
+#include "InputHandler.h"
+#include "ExpressionProgram.h"
+#include "ExpressionJit.h"
+#include "ExpressionOptimiser.h"
+#include "GraphLogic.h"
+#include "AdaptiveSampler.h"
+#include "ThreadPool.h"
+
+// Times every stage a graph goes through on the rebuild thread, from the text the user typed to the finished mesh, without a window or a GPU.
+// Each stage is run several times and its latency percentiles are written to standard output as JSON, so runs can be compared by a script.
+// Usage: PipelineBenchmark [--runs N] [file with one expression per line], the built in corpus is used if no file is given
+
+static const int defaultRuns = 15;
+static const int resolutions[] = { 20, 80, 256, 1024 }; // the Low and High settings, and two custom sizes
+
+static const char* const builtInCorpus[] = {
+	"x^2+y^2",
+	"x*y",
+	"x^2-y^2",
+	"x/y",
+	"(x+y)^3",
+	"x^3-3*x*y^2",
+	"2xy - y^3",
+	"(x^2+y^2)^(1/2)",
+	"1/(x^2+y^2+1)",
+	"x^4+y^4-2*x^2*y^2+x*y",
+};
+
+// The latencies of one stage, in microseconds
+struct StageTimes
+{
+	std::vector<double> microseconds;
+
+	double percentile(double p) const // nearest rank, so every value reported was actually measured
+	{
+		std::vector<double> sorted = microseconds;
+		std::sort(sorted.begin(), sorted.end());
+
+		size_t rank = (size_t)(p / 100.0 * sorted.size() + 0.999999);
+		if (rank < 1) rank = 1;
+		if (rank > sorted.size()) rank = sorted.size();
+		return sorted[rank - 1];
+	}
+};
+
+static StageTimes time_runs(int runs, const std::function<void()>& stage)
+{
+	StageTimes times;
+	for (int i = 0; i < runs; i++)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		stage();
+		const auto end = std::chrono::steady_clock::now();
+
+		times.microseconds.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+	}
+	return times;
+}
+
+static std::string json_string(const std::string& text)
+{
+	std::string escaped = "\"";
+	for (char character : text)
+	{
+		if (character == '"' || character == '\\') escaped += '\\';
+		if ((unsigned char)character < 0x20) continue; // control characters are never part of an expression
+		escaped += character;
+	}
+	return escaped + "\"";
+}
+
+static std::string json_times(const StageTimes& times)
+{
+	std::ostringstream json;
+	json << "{ \"p50_us\": " << times.percentile(50) << ", \"p90_us\": " << times.percentile(90) << ", \"p99_us\": " << times.percentile(99)
+		<< ", \"min_us\": " << times.percentile(0) << ", \"max_us\": " << times.percentile(100) << " }";
+	return json.str();
+}
+
+int main(int argc, char** argv)
+{
+	int runs = defaultRuns;
+	std::vector<std::string> corpus(std::begin(builtInCorpus), std::end(builtInCorpus));
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string argument = argv[i];
+
+		if (argument == "--runs" && i + 1 < argc)
+		{
+			runs = std::max(1, std::atoi(argv[++i]));
+			continue;
+		}
+
+		std::ifstream inputFile(argument);
+		if (!inputFile.is_open())
+		{
+			std::cerr << "Could not open " << argument << std::endl;
+			return 1;
+		}
+
+		corpus.clear();
+		std::string equation;
+		while (getline(inputFile, equation))
+		{
+			if (equation.length() != 0) corpus.push_back(equation);
+		}
+	}
+
+	const GraphDomain domain = { 0.f, 0.f, 0 };
+
+	std::ostringstream results; // printed once every stage has run
+	results << "{\n  \"threads\": " << ThreadPool::get_shared_pool().get_thread_count() << ",\n  \"jit_supported\": " << (ExpressionJit::is_supported() ? "true" : "false")
+		<< ",\n  \"runs\": " << runs << ",\n  \"expressions\": [";
+
+	for (size_t e = 0; e < corpus.size(); e++)
+	{
+		const std::string& equation = corpus[e];
+		results << (e == 0 ? "\n" : ",\n") << "    { \"expression\": " << json_string(equation);
+
+		bool errorFlag = false;
+		std::vector<Token> postfixExpression;
+		InputHandler::verify_and_convert_function(equation, &postfixExpression, &errorFlag);
+		const ExpressionProgram program = errorFlag ? ExpressionProgram() : ExpressionProgram::compile(postfixExpression, &errorFlag);
+
+		if (errorFlag || program.is_empty())
+		{
+			results << ", \"error\": \"invalid expression\" }";
+			continue;
+		}
+
+		// the same steps, in the same order, as GraphRebuilder::build_meshes takes for a grid graph
+		const StageTimes parseTimes = time_runs(runs, [&]()
+		{
+			bool flag = false;
+			InputHandler::verify_and_convert_function(equation, &postfixExpression, &flag);
+		});
+
+		const StageTimes compileTimes = time_runs(runs, [&]()
+		{
+			bool flag = false;
+			ExpressionProgram::compile(postfixExpression, &flag);
+		});
+
+		ExpressionProgram optimisedProgram;
+		const StageTimes optimiseTimes = time_runs(runs, [&]() { optimisedProgram = ExpressionOptimiser::optimise(program, true); });
+
+		const StageTimes jitTimes = time_runs(runs, [&]() { ExpressionJit jit(optimisedProgram); });
+
+		const ExpressionJit evaluator(optimisedProgram);
+
+		results << ", \"instructions\": " << program.get_instructions().size() << ", \"optimised_instructions\": " << optimisedProgram.get_instructions().size()
+			<< ", \"native\": " << (evaluator.is_gradient_compiled() ? "true" : "false") << ",\n      \"stages\": {\n"
+			<< "        \"parse\": " << json_times(parseTimes) << ",\n"
+			<< "        \"compile\": " << json_times(compileTimes) << ",\n"
+			<< "        \"optimise\": " << json_times(optimiseTimes) << ",\n"
+			<< "        \"jit\": " << json_times(jitTimes) << "\n      },\n      \"grid\": [";
+
+		for (size_t r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++)
+		{
+			const GridWindow window = GraphLogic::get_grid_window(domain, resolutions[r]);
+
+			const StageTimes sampleTimes = time_runs(runs, [&]() { GraphLogic::sample_points(evaluator, window); });
+
+			const double samples = (double)resolutions[r] * resolutions[r];
+
+			results << (r == 0 ? "\n" : ",\n") << "        { \"sample_size\": " << resolutions[r] << ", \"sample\": " << json_times(sampleTimes)
+				<< ", \"samples_per_second\": " << samples / (sampleTimes.percentile(50) * 1e-6) << " }";
+		}
+
+		// the adaptive sampler is evaluated point by point rather than by row, so it is given a program without row hoisting as the rebuilder does
+		const ExpressionJit adaptiveEvaluator(ExpressionOptimiser::optimise(program, false));
+		size_t adaptiveVertexCount = 0;
+
+		const StageTimes adaptiveTimes = time_runs(runs, [&]()
+		{
+			adaptiveVertexCount = AdaptiveSampler::sample(adaptiveEvaluator, AdaptiveSampler::defaultTolerance, domain).vertices.size();
+		});
+
+		results << "\n      ],\n      \"adaptive\": { \"sample\": " << json_times(adaptiveTimes) << ", \"vertices\": " << adaptiveVertexCount
+			<< ", \"samples_per_second\": " << adaptiveVertexCount / (adaptiveTimes.percentile(50) * 1e-6) << " } }";
+	}
+
+	results << "\n  ]\n}\n";
+
+	std::cout << results.str();
+	return 0;
+}